@@ -5,6 +5,9 @@
 #include "PageTable.hpp"
 #include "MemArea.hpp"
 #include "Process.hpp"
+#include "Log.hpp"
+#include "Ksm.hpp"
+#include "Pte.hpp"
 
 #include <algorithm>
 #include <string.h>
@@ -15,6 +18,9 @@ Slab<AddressSpace> AddressSpace::sSlab;
 //! Slab allocator for mappings
 static Slab<struct Mapping> mappingSlab;
 
+PageTable *AddressSpace::sFCSEPageTable;
+AddressSpace *AddressSpace::sFCSESlots[FCSE_NUM_PIDS];
+
 /*!
  * \brief Constructor
  * \param Page table to use, or 0 to allocate a new one
@@ -22,83 +28,302 @@ static Slab<struct Mapping> mappingSlab;
 AddressSpace::AddressSpace(PageTable *pageTable)
 {
 	if(pageTable == 0) {
-		pageTable = new PageTable(Kernel::process()->addressSpace()->pageTable());
+		pageTable = new PageTable();
 	}
 
 	mPageTable = pageTable;
+	mFCSEPid = 0;
+	mMergeable = false;
 }
 
 AddressSpace::~AddressSpace()
 {
-	delete mPageTable;
+	if(mMergeable) {
+		Ksm::removeSpace(this);
+	}
+
+	if(mFCSEPid != 0) {
+		// The page table is shared with the other slots, so only empty out this one
+		mPageTable->unmap(mva(0), FCSE_SLOT_SIZE);
+		sFCSESlots[mFCSEPid] = 0;
+	} else {
+		delete mPageTable;
+	}
 
-	struct Mapping *next;
-	for(struct Mapping *mapping = mMappings.head(); mapping != 0; mapping = next) {
-		next = mMappings.next(mapping);
+	while(struct Mapping *mapping = mMappings.head()) {
+		mMappings.remove(mapping);
+		mapping->area = 0;
 		mappingSlab.free(mapping);
 	}
 }
 
+/*!
+ * \brief Create an address space in a Fast Context Switch Extension slot
+ *
+ * All FCSE address spaces share a single page table.  The MMU relocates
+ * addresses below FCSE_SLOT_SIZE into the slot selected by the process ID
+ * register, so switching between two of these spaces only requires a change
+ * of process ID, with no cache or TLB flush.  In return, the space is
+ * limited to FCSE_SLOT_SIZE bytes.
+ *
+ * Addresses above the slot are not relocated, so every slot's memory is
+ * also visible at its relocated address.  To keep the slots apart, each one
+ * lies in an ARM domain of its own, and only the kernel's domain and the
+ * current slot's are enabled while a slot is active.  This limits the
+ * number of slots to one less than the number of domains.
+ * \return New address space, or 0 if all slots are in use
+ */
+AddressSpace *AddressSpace::createFCSE()
+{
+#ifdef ARCH_ARMV7
+	// ARMv7 has no FCSE.  Its TLB entries are tagged with address space IDs
+	// instead, so every address space already switches without a flush.
+	return 0;
+#endif
+
+	// Slot 0 is not relocated, and slots must lie below the kernel.  Domain 0
+	// belongs to the kernel, so each slot takes the domain matching its PID.
+	for(unsigned int pid = 1; pid < PTE_NUM_DOMAINS && (pid + 1) * FCSE_SLOT_SIZE <= KERNEL_START; pid++) {
+		if(sFCSESlots[pid] != 0) {
+			continue;
+		}
+
+		if(!sFCSEPageTable) {
+			sFCSEPageTable = new PageTable();
+			sFCSEPageTable->setSlotDomains();
+		}
+
+		AddressSpace *space = new AddressSpace(sFCSEPageTable);
+		space->mFCSEPid = pid;
+		sFCSESlots[pid] = space;
+		return space;
+	}
+
+	return 0;
+}
+
+/*!
+ * \brief Load this address space into the MMU
+ *
+ * Switching between address spaces which share the FCSE page table only
+ * changes the process ID and the set of enabled domains.
+ */
+void AddressSpace::activate()
+{
+	if(!mPageTable->active()) {
+		mPageTable->activate();
+	}
+
+#ifndef ARCH_ARMV7
+	SetFCSEPID(mFCSEPid << FCSE_PID_SHIFT);
+
+	// A space in a slot can reach only the kernel's domain and its own, and
+	// not the other slots which share its page table
+	if(mFCSEPid != 0) {
+		SetDomainAccess(DOMAIN_ACCESS_CLIENT(0) | DOMAIN_ACCESS_CLIENT(mFCSEPid));
+	} else {
+		SetDomainAccess(DOMAIN_ACCESS_ALL_CLIENT);
+	}
+#endif
+}
+
+/*!
+ * \brief Convert a virtual address into the modified virtual address which
+ *        the page table, TLB and caches see
+ * \param vaddr Virtual address
+ * \return Modified virtual address
+ */
+void *AddressSpace::mva(void *vaddr)
+{
+	if(mFCSEPid != 0 && (unsigned)vaddr < FCSE_SLOT_SIZE) {
+		return (char*)vaddr + (mFCSEPid << FCSE_PID_SHIFT);
+	}
+
+	return vaddr;
+}
+
+/*!
+ * \brief Convert a modified virtual address back into a virtual address.
+ *        Addresses outside of this space's slot are returned unchanged.
+ * \param mva Modified virtual address
+ * \return Virtual address
+ */
+void *AddressSpace::vaddrFromMVA(void *mva)
+{
+	unsigned slotStart = mFCSEPid << FCSE_PID_SHIFT;
+	if(mFCSEPid != 0 && (unsigned)mva >= slotStart && (unsigned)mva - slotStart < FCSE_SLOT_SIZE) {
+		return (char*)mva - slotStart;
+	}
+
+	return mva;
+}
+
 /*!
  * \brief Map a memory area into the address space
  * \param area Area to map
  * \param vaddr Virtual address to map
  * \param offset Offset into memory area
  * \param size Size of mapping
+ * \return True on success, false if the range is empty, does not fit in the
+ *         address space or the area, or overlaps an existing mapping.  On
+ *         failure, the area is released if the caller did not hold onto it.
  */
-void AddressSpace::map(MemArea *area, void *vaddr, unsigned int offset, unsigned int size)
+bool AddressSpace::map(MemArea *area, void *vaddr, unsigned int offset, unsigned int size)
 {
+	char *start = (char*)PAGE_ADDR_ROUND_DOWN(vaddr);
+	unsigned int mapOffset = PAGE_ADDR_ROUND_DOWN(offset);
+	unsigned int mapSize = PAGE_SIZE_ROUND_UP(size + offset - mapOffset);
+
+	if(mapSize == 0 || offset > (unsigned)area->size() || size > area->size() - offset) {
+		Ref<MemArea> discard = area;
+		return false;
+	}
+
+	if((unsigned)start >= (unsigned)userEnd() || mapSize > (unsigned)userEnd() - (unsigned)start) {
+		Log::printf("addressSpace: mapping at %p does not fit in address space\n", vaddr);
+		Ref<MemArea> discard = area;
+		return false;
+	}
+
+	// Lookups assume that mappings never overlap, so refuse any range which
+	// runs into an existing mapping
+	struct Mapping *next = nextMapping(start);
+	if(next && (char*)next->vaddr < start + mapSize) {
+		Ref<MemArea> discard = area;
+		return false;
+	}
+
 	struct Mapping *mapping = mappingSlab.allocate();
-	mapping->vaddr = (void*)PAGE_ADDR_ROUND_DOWN(vaddr);
-	mapping->offset = PAGE_ADDR_ROUND_DOWN(offset);
-	mapping->size = PAGE_SIZE_ROUND_UP(size + offset - mapping->offset);
+	mapping->vaddr = start;
+	mapping->offset = mapOffset;
+	mapping->size = mapSize;
 	mapping->area = area;
 
 	// Map the area into the page table
-	area->map(mPageTable, vaddr, mapping->offset, mapping->size);
-
-	// Now add the mapping into the list of mappings, in sorted order
-	bool found = false;
-	for(struct Mapping *mappingCursor = mMappings.head(); mappingCursor != 0; mappingCursor = mMappings.next(mappingCursor)) {
-		if(mappingCursor->vaddr > mapping->vaddr) {
-			mMappings.addAfter(mapping, mappingCursor);
-			found = true;
-			break;
-		}
-	}
+	area->map(mPageTable, mva(vaddr), mapping->offset, mapping->size);
 
-	if(!found) {
-		mMappings.addTail(mapping);
+	// Now add the mapping into the tree of mappings.  The page table takes
+	// care of discarding any TLB entries made stale by the new mapping.
+	mMappings.add(mapping);
+
+	// New memory may hold pages which can be merged
+	if(mMergeable) {
+		Ksm::wake();
 	}
 
-	// Since mappings have changed, TLB entries must be flushed
-	FlushTLB();
+	return true;
 }
 
 /*!
- * \brief Expand an existing mapping
- * \param area Area to expand
+ * \brief Expand an existing mapping, growing its memory area to match
+ * \param vaddr Base address of mapping
  * \param size New size to map
+ * \return True on success, false if there is no mapping at the address, the
+ *         expanded mapping would run into the next one or off the end of the
+ *         address space, or the area could not grow
  */
-void AddressSpace::expandMap(MemArea *area, unsigned int size)
+bool AddressSpace::expandMap(void *vaddr, unsigned int size)
 {
-	struct Mapping *mapping = 0;
-	for(struct Mapping *mappingCursor = mMappings.head(); mappingCursor != 0; mappingCursor = mMappings.next(mappingCursor)) {
-		if(mappingCursor->area.ptr() == area) {
-			mapping = mappingCursor;
-			break;
-		}
+	struct Mapping *mapping = mMappings.find(vaddr);
+	if(!mapping || size > (unsigned)userEnd() - (unsigned)vaddr) {
+		return false;
+	}
+
+	unsigned int oldSize = mapping->size;
+	unsigned int newSize = PAGE_SIZE_ROUND_UP(size);
+	if(newSize <= oldSize) {
+		return true;
+	}
+
+	struct Mapping *next = mMappings.next(mapping);
+	if(next && (char*)vaddr + newSize > (char*)next->vaddr) {
+		return false;
+	}
+
+	// The mapping need not start at the beginning of the area, if its front
+	// has been unmapped, so the area must cover the offset as well
+	if(!mapping->area->expand(mapping->offset + newSize)) {
+		return false;
+	}
+
+	// The existing part of the mapping is already in the page table, so only
+	// the newly added range needs to be mapped
+	mapping->size = newSize;
+	mapping->area->map(mPageTable, mva((char*)mapping->vaddr + oldSize), mapping->offset + oldSize, newSize - oldSize);
+
+	if(mMergeable) {
+		Ksm::wake();
 	}
 
+	return true;
+}
+
+/*!
+ * \brief Remove a range of addresses from the address space
+ *
+ * Mappings which partially overlap the range are trimmed, or split in two
+ * if the range lies in their middle.
+ * \param vaddr Start of range
+ * \param size Size of range
+ */
+void AddressSpace::unmap(void *vaddr, unsigned int size)
+{
+	char *start = (char*)PAGE_ADDR_ROUND_DOWN(vaddr);
+	char *end = (char*)PAGE_SIZE_ROUND_UP((unsigned)vaddr + size);
+
+	// Start from the mapping containing the start of the range, if any,
+	// and otherwise from the first mapping after it
+	struct Mapping *mapping = mMappings.findFloor(start);
 	if(!mapping) {
-		return;
+		mapping = mMappings.head();
+	} else if((char*)mapping->vaddr + mapping->size <= start) {
+		mapping = mMappings.next(mapping);
 	}
 
-	mapping->size = PAGE_SIZE_ROUND_UP(size);
-	area->map(mPageTable, mapping->vaddr, mapping->offset, mapping->size);
+	while(mapping && (char*)mapping->vaddr < end) {
+		struct Mapping *next = mMappings.next(mapping);
+		unmapPart(mapping, std::max(start, (char*)mapping->vaddr), std::min(end, (char*)mapping->vaddr + mapping->size));
+		mapping = next;
+	}
+}
+
+// Remove a page-aligned range, which lies within a single mapping
+void AddressSpace::unmapPart(struct Mapping *mapping, char *start, char *end)
+{
+	char *mapStart = (char*)mapping->vaddr;
+	char *mapEnd = mapStart + mapping->size;
 
-	// Since mappings have changed, TLB entries must be flushed
-	FlushTLB();
+	mPageTable->unmap(mva(start), end - start);
+
+	// If no other mapping refers to the area, the contents of the range can
+	// never be seen again, so let the area release them
+	if(mapping->area->refCount() == 1) {
+		mapping->area->discard(mapping->offset + (start - mapStart), end - start);
+	}
+
+	if(start == mapStart && end == mapEnd) {
+		mMappings.remove(mapping);
+		mapping->area = 0;
+		mappingSlab.free(mapping);
+	} else if(start == mapStart) {
+		// Trim the front of the mapping.  Mappings never overlap, so moving the
+		// base address up does not change its position in the tree.
+		mapping->vaddr = end;
+		mapping->offset += end - mapStart;
+		mapping->size = mapEnd - end;
+	} else if(end == mapEnd) {
+		mapping->size = start - mapStart;
+	} else {
+		// Split the mapping around the hole
+		struct Mapping *tail = mappingSlab.allocate();
+		tail->vaddr = end;
+		tail->offset = mapping->offset + (end - mapStart);
+		tail->size = mapEnd - end;
+		tail->area = mapping->area;
+		mMappings.add(tail);
+
+		mapping->size = start - mapStart;
+	}
 }
 
 /*!
@@ -107,13 +332,203 @@ void AddressSpace::expandMap(MemArea *area, unsigned int size)
  */
 MemArea *AddressSpace::lookupMap(void *vaddr)
 {
-	for(struct Mapping *mappingCursor = mMappings.head(); mappingCursor != 0; mappingCursor = mMappings.next(mappingCursor)) {
-		if(mappingCursor->vaddr == vaddr) {
-			return mappingCursor->area.ptr();
+	struct Mapping *mapping = mMappings.find(vaddr);
+	if(!mapping) {
+		return 0;
+	}
+
+	return mapping->area.ptr();
+}
+
+/*!
+ * \brief Find the mapping containing an address, or the first one above it
+ * \param vaddr Virtual address
+ * \return Mapping, or 0 if there are none at or above the address
+ */
+struct Mapping *AddressSpace::nextMapping(void *vaddr)
+{
+	struct Mapping *mapping = mMappings.findFloor(vaddr);
+	if(!mapping) {
+		return mMappings.head();
+	}
+
+	if((char*)vaddr >= (char*)mapping->vaddr + mapping->size) {
+		return mMappings.next(mapping);
+	}
+
+	return mapping;
+}
+
+/*!
+ * \brief Find a free range of addresses, as high up as possible
+ *
+ * Ranges are handed out top-down, so they end up below the stack and clear
+ * of the heap, which grows up from low in the address space.  The first page
+ * is never handed out, so that null pointers still fault.
+ * \param size Size of range
+ * \return Start of range, or 0 if no gap is large enough
+ */
+void *AddressSpace::findFree(unsigned int size)
+{
+	size = PAGE_SIZE_ROUND_UP(size);
+	if(size == 0) {
+		return 0;
+	}
+
+	unsigned gapStart = PAGE_SIZE;
+	unsigned found = 0;
+	struct Mapping *mapping = mMappings.head();
+	while(1) {
+		unsigned gapEnd = mapping ? (unsigned)mapping->vaddr : (unsigned)userEnd();
+		if(gapEnd > gapStart && gapEnd - gapStart >= size) {
+			found = gapEnd - size;
 		}
+
+		if(!mapping) {
+			break;
+		}
+
+		gapStart = std::max(gapStart, (unsigned)mapping->vaddr + mapping->size);
+		mapping = mMappings.next(mapping);
 	}
 
-	return 0;
+	return (void*)found;
+}
+
+/*!
+ * \brief Allow identical pages in this address space to be merged with
+ *        those of other mergeable address spaces
+ */
+void AddressSpace::setMergeable()
+{
+	if(!mMergeable) {
+		mMergeable = true;
+		Ksm::addSpace(this);
+	}
+}
+
+// Find the mapping which contains a given address
+struct Mapping *AddressSpace::findMapping(void *vaddr)
+{
+	// Mappings never overlap, so only the closest one at or below the
+	// address can contain it
+	struct Mapping *mapping = mMappings.findFloor(vaddr);
+	if(!mapping || (char*)vaddr >= (char*)mapping->vaddr + mapping->size) {
+		return 0;
+	}
+
+	return mapping;
+}
+
+/*!
+ * \brief Attempt to resolve a fault on an address in this address space
+ * \param vaddr Faulting address
+ * \return True if the fault was resolved, false if the access was invalid
+ */
+bool AddressSpace::handleFault(void *vaddr)
+{
+	struct Mapping *mapping = findMapping(vaddr);
+	if(!mapping) {
+		return false;
+	}
+
+	// Ask the backing memory area to supply the page
+	void *pageVAddr = (void*)PAGE_ADDR_ROUND_DOWN(vaddr);
+	unsigned int offset = mapping->offset + ((char*)pageVAddr - (char*)mapping->vaddr);
+	return mapping->area->fault(mPageTable, mva(pageVAddr), offset, mapping->offset, mapping->offset + mapping->size);
+}
+
+/*!
+ * \brief Translate a virtual address into a physical address, faulting in
+ *        the backing page if it is not yet present
+ *
+ * Kernel accesses through the translated address bypass the MMU, so when
+ * writing, pages shared with other address spaces are copied first.
+ * \param vaddr Virtual address
+ * \param write True if the caller intends to write to the address
+ * \return Physical address, or PADDR_INVALID if the address is not valid
+ */
+PAddr AddressSpace::translate(void *vaddr, bool write)
+{
+	// At most two faults are needed--one to map the page, and one to copy it
+	for(int i=0; i<3; i++) {
+		PAddr paddr = mPageTable->translateVAddr(mva(vaddr));
+
+		if(paddr != PADDR_INVALID) {
+			bool shared = write && PADDR_IS_RAM(paddr) && Page::fromPAddr(paddr)->refCount() > 1;
+			if(!shared) {
+				return paddr;
+			}
+		}
+
+		if(!handleFault(vaddr)) {
+			break;
+		}
+	}
+
+	return PADDR_INVALID;
+}
+
+/*!
+ * \brief Create a copy-on-write clone of this address space
+ * \return New address space, or 0 if memory ran out before every mapping
+ *         could be cloned
+ */
+AddressSpace *AddressSpace::clone()
+{
+	AddressSpace *space = new AddressSpace();
+
+	for(struct Mapping *mapping = mMappings.head(); mapping != 0; mapping = mMappings.next(mapping)) {
+		// A cloned area which could not get a page array comes back empty,
+		// and fails to map
+		MemArea *area = mapping->area->clone();
+		bool mapped = space->map(area, mapping->vaddr, mapping->offset, mapping->size);
+
+		// Remap the original area, now that its pages are shared.  If the map
+		// failed, the clone has already let go of them again, and the parent
+		// simply takes write faults on pages that turn out to be its own.
+		mapping->area->map(mPageTable, mva(mapping->vaddr), mapping->offset, mapping->size);
+
+		if(!mapped) {
+			delete space;
+			return 0;
+		}
+	}
+
+	if(mMergeable) {
+		space->setMergeable();
+	}
+
+	return space;
+}
+
+/*!
+ * \brief Prepare to access memory in this address space through the kernel's
+ *        mapping of physical memory
+ *
+ * The caches are indexed by virtual address, so data written through a
+ * user address is not visible through the kernel address, or vice versa,
+ * until it has been cleaned out to memory.  Call endKernelAccess on the
+ * kernel address once the access is complete.
+ * \param vaddr User virtual address
+ * \param size Size of access
+ */
+void AddressSpace::beginKernelAccess(void *vaddr, int size)
+{
+	// Only the active address space can have lines in the cache
+	if(mPageTable->active()) {
+		CleanInvalidateDCacheRange(mva(vaddr), size);
+	}
+}
+
+/*!
+ * \brief Finish an access begun with beginKernelAccess
+ * \param kernelVAddr Kernel virtual address that was accessed
+ * \param size Size of access
+ */
+void AddressSpace::endKernelAccess(void *kernelVAddr, int size)
+{
+	CleanInvalidateDCacheRange(kernelVAddr, size);
 }
 
 // Round virtual address up to page boundary
@@ -147,15 +562,38 @@ void AddressSpace::memcpy(AddressSpace *destSpace, void *dest, AddressSpace *src
 
 		// Translate addresses to kernel space
 		if(srcSpace != 0) {
-			srcKernel = PADDR_TO_VADDR(srcSpace->pageTable()->translateVAddr(srcKernel));
+			PAddr paddr = srcSpace->translate(srcKernel, false);
+			if(paddr == PADDR_INVALID) {
+				break;
+			}
+			srcKernel = PADDR_TO_VADDR(paddr);
 		}
 
-		if(destSpace != 0 ) {
-			destKernel = PADDR_TO_VADDR(destSpace->pageTable()->translateVAddr(destKernel));
+		if(destSpace != 0) {
+			PAddr paddr = destSpace->translate(destKernel, true);
+			if(paddr == PADDR_INVALID) {
+				break;
+			}
+			destKernel = PADDR_TO_VADDR(paddr);
+		}
+
+		// Copy memory, keeping the cache coherent between the user and kernel
+		// addresses of each side
+		if(srcSpace != 0) {
+			srcSpace->beginKernelAccess((void*)srcPtr, copySize);
+		}
+		if(destSpace != 0) {
+			destSpace->beginKernelAccess((void*)destPtr, copySize);
 		}
 
-		// Copy memory
 		::memcpy(destKernel, srcKernel, copySize);
+
+		if(srcSpace != 0) {
+			endKernelAccess(srcKernel, copySize);
+		}
+		if(destSpace != 0) {
+			endKernelAccess(destKernel, copySize);
+		}
 		srcPtr += copySize;
 		destPtr += copySize;
 		size -= copySize;
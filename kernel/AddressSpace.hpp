@@ -1,6 +1,7 @@
 #ifndef ADDRESS_SPACE_H
 #define ADDRESS_SPACE_H
 
+#include "Tree.hpp"
 #include "List.hpp"
 #include "Slab.hpp"
 #include "MemArea.hpp"
@@ -9,10 +10,17 @@
 
 class PageTable;
 
+//! Size of the low address range which the FCSE relocates into a process's slot
+#define FCSE_SLOT_SIZE (32 * 1024 * 1024)
+//! Position of the process ID in the FCSE PID register
+#define FCSE_PID_SHIFT 25
+//! Number of values the FCSE process ID can take
+#define FCSE_NUM_PIDS 128
+
 /*!
  * \brief A mapped area in an address space
  */
-struct Mapping : public ListEntry {
+struct Mapping : public TreeEntry {
 	void *vaddr; //!< Virtual address
 	unsigned int offset; //!< Offset into memory area
 	unsigned int size; //!< Size of mapping
@@ -22,12 +30,13 @@ struct Mapping : public ListEntry {
 /*!
  * \brief Represents a set of mappings into a virtual address space.
  */
-class AddressSpace {
+class AddressSpace : public ListEntry {
 public:
 	AddressSpace(PageTable *pageTable = 0);
 	~AddressSpace();
 
 	static void init();
+	static AddressSpace *createFCSE();
 
 	/*!
 	 * \brief Page table associated with this address space
@@ -35,12 +44,35 @@ public:
 	 */
 	struct PageTable *pageTable() { return mPageTable; }
 
-	void map(MemArea *area, void *vaddr, unsigned int offset, unsigned int size);
-	void expandMap(MemArea *area, unsigned int size);
+	/*!
+	 * \brief End of the range of addresses available to userspace
+	 * \return Address just past the highest usable user address
+	 */
+	void *userEnd() { return (void*)(mFCSEPid ? FCSE_SLOT_SIZE : USER_END); }
+
+	void activate();
+	void *mva(void *vaddr);
+	void *vaddrFromMVA(void *mva);
+
+	bool map(MemArea *area, void *vaddr, unsigned int offset, unsigned int size);
+	bool expandMap(void *vaddr, unsigned int size);
+	void unmap(void *vaddr, unsigned int size);
 	MemArea *lookupMap(void *vaddr);
+	struct Mapping *nextMapping(void *vaddr);
+	void *findFree(unsigned int size);
+
+	void setMergeable();
+
+	bool handleFault(void *vaddr);
+	PAddr translate(void *vaddr, bool write);
+
+	AddressSpace *clone();
 
 	static void memcpy(AddressSpace *destSpace, void *dest, AddressSpace *srcSpace, void *src, int size);
 
+	void beginKernelAccess(void *vaddr, int size);
+	static void endKernelAccess(void *kernelVAddr, int size);
+
 	//! Allocator
 	void *operator new(size_t size) { return sSlab.allocate(); }
 	void operator delete(void *p) { sSlab.free((AddressSpace*)p); }
@@ -48,9 +80,16 @@ public:
 	static AddressSpace *Kernel;
 
 private:
+	struct Mapping *findMapping(void *vaddr);
+	void unmapPart(struct Mapping *mapping, char *start, char *end);
+
 	PageTable *mPageTable; //!< Page table
-	List<struct Mapping> mMappings; //!< List of mapped areas
+	unsigned int mFCSEPid; //!< FCSE process ID, or 0 if the space has a page table to itself
+	bool mMergeable; //!< True if identical pages may be merged with those of other address spaces
+	Tree<struct Mapping, void*, &Mapping::vaddr> mMappings; //!< Mapped areas, ordered by address
 
 	static Slab<AddressSpace> sSlab;
+	static PageTable *sFCSEPageTable; //!< Page table shared by all FCSE address spaces
+	static AddressSpace *sFCSESlots[FCSE_NUM_PIDS]; //!< Address space occupying each FCSE slot
 };
 #endif
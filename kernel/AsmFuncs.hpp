@@ -4,12 +4,27 @@
 #include "Task.hpp"
 
 extern "C" {
-	void EnterUser(void (*userStart)(), void* userStack, void *cmdline);
-	void SetMMUBase(PAddr table);
+	void EnterUser(void (*userStart)(), void* userStack, void *cmdline, void *kernelStack);
+	void ResumeUser(unsigned *regs, void *kernelStack);
+	void ResetCaches();
+	void SetMMUBase(PAddr table, unsigned asid);
 	void SwitchToAsm(unsigned *regsCurrent, unsigned *regsNext);
 	void RunFirstAsm(unsigned *regs);
 	void FlushTLB();
+	void InvalidateTLBEntry(void *vaddr);
+	void InvalidateICache();
+	void CleanDCacheRange(void *start, int size);
+	void InvalidateDCacheRange(void *start, int size);
+	void CleanInvalidateDCacheRange(void *start, int size);
 	void WaitForInterrupt();
+
+#ifdef ARCH_ARMV7
+	void SetKernelMMUBase(PAddr table);
+#else
+	void FlushCaches();
+	void SetFCSEPID(unsigned pid);
+	void SetDomainAccess(unsigned access);
+#endif
 }
 
 #endif
@@ -22,30 +22,63 @@ finish:
 	bx lr
 .size SwitchToAsm, . - SwitchToAsm
 
-# Set page table address.  r0 = physical address
-.globl SetMMUBase
-.type SetMMUBase,%function
-SetMMUBase:
-	# Set translation table base address
-	mcr p15, 0, r0, c2, c0, 0
-
-	# Flush TLB
+# Invalidate the instruction cache
+.globl InvalidateICache
+.type InvalidateICache,%function
+InvalidateICache:
 	mov r0, #0
-	mcr p15, 0, r0, c8, c5, 0
-
+	mcr p15, 0, r0, c7, c5, 0
 	bx lr
-.size SetMMUBase, . - SetMMUBase
-
-# Flush the TLB
-.globl FlushTLB
-.type FlushTLB,%function
-FlushTLB:
+.size InvalidateICache, . - InvalidateICache
+
+# Write dirty data cache lines in a range back to memory, and
+# drain the write buffer.  r0 = start address, r1 = size
+.globl CleanDCacheRange
+.type CleanDCacheRange,%function
+CleanDCacheRange:
+	add r1, r0, r1
+	bic r0, r0, #31
+1:	mcr p15, 0, r0, c7, c10, 1
+	add r0, r0, #32
+	cmp r0, r1
+	blo 1b
+	mov r0, #0
+	mcr p15, 0, r0, c7, c10, 4
+	bx lr
+.size CleanDCacheRange, . - CleanDCacheRange
+
+# Discard data cache lines in a range without writing them back.
+# r0 = start address, r1 = size
+.globl InvalidateDCacheRange
+.type InvalidateDCacheRange,%function
+InvalidateDCacheRange:
+	add r1, r0, r1
+	bic r0, r0, #31
+1:	mcr p15, 0, r0, c7, c6, 1
+	add r0, r0, #32
+	cmp r0, r1
+	blo 1b
+	bx lr
+.size InvalidateDCacheRange, . - InvalidateDCacheRange
+
+# Write back and discard data cache lines in a range, and drain
+# the write buffer.  r0 = start address, r1 = size
+.globl CleanInvalidateDCacheRange
+.type CleanInvalidateDCacheRange,%function
+CleanInvalidateDCacheRange:
+	add r1, r0, r1
+	bic r0, r0, #31
+1:	mcr p15, 0, r0, c7, c14, 1
+	add r0, r0, #32
+	cmp r0, r1
+	blo 1b
 	mov r0, #0
-	mcr p15, 0, r0, c8, c5, 0
+	mcr p15, 0, r0, c7, c10, 4
 	bx lr
-.size FlushTLB, . - FlushTLB
+.size CleanInvalidateDCacheRange, . - CleanInvalidateDCacheRange
 
-# Enter userspace for the first time.  r0 = starting pc, r1 = starting sp
+# Enter userspace for the first time.  r0 = starting pc, r1 = starting sp,
+# r2 = command line, r3 = top of kernel stack
 .globl EnterUser
 .type EnterUser,%function
 EnterUser:
@@ -57,13 +90,13 @@ EnterUser:
 	# Carve out a space on the stack to use for initializing
 	# the registers
 	sub r5, sp, #60
-	mov r3, #0
+	mov r6, #0
 
-	# Now zero them all out
+	# Now zero them all out.  r3 still holds the kernel stack top.
 	mov r4, #16
 clearLoop:
 	sub r4, r4, #1
-	str r3, [r5, r4, lsl #2]
+	str r6, [r5, r4, lsl #2]
 	cmp r4, #0
 	bne clearLoop
 
@@ -76,6 +109,10 @@ clearLoop:
 	# Move starting pc into lr, since it's not banked
 	mov lr, r0
 
+	# Nothing on the kernel stack is needed once in userspace, so reset it
+	# to the top.  This places every syscall frame at a fixed location.
+	mov sp, r3
+
 	# Now initialize all usermode registers to the values
 	# prepared above
 	ldm r5, {r0-r14}^
@@ -90,6 +127,34 @@ clearLoop:
 	# Poof!
 .size EnterUser, . - EnterUser
 
+# Resume userspace with a full set of registers.  r0 = array of
+# r0-r15, r1 = top of kernel stack
+.globl ResumeUser
+.type ResumeUser,%function
+ResumeUser:
+	# Prepare the usermode CPSR by clearing the mode bits
+	mrs r5, cpsr
+	bic r5, #0x8f
+	msr spsr, r5
+
+	# Reset the kernel stack, as in EnterUser
+	mov sp, r1
+
+	# Load the userspace pc into lr, and the rest into the
+	# usermode registers
+	ldr lr, [r0, #60]
+	ldm r0, {r0-r14}^
+
+	# ARM manual says to nop between accessing different
+	# register banks
+	nop
+
+	# Transfer to usermode
+	movs pc, lr
+
+	# Poof!
+.size ResumeUser, . - ResumeUser
+
 # Wait for an interrupt to be received
 .globl WaitForInterrupt
 .type WaitForInterrupt,%function
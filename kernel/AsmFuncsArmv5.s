@@ -0,0 +1,95 @@
+# ARMv5 memory management and cache functions.  The caches on these
+# cores are indexed by virtual address, and the TLB holds no address
+# space tags, so both must be emptied whenever the mappings change.
+
+.section .low
+
+# Discard anything left in the caches from before reset.  Called with
+# the MMU off.
+.globl ResetCaches
+.type ResetCaches,%function
+ResetCaches:
+	mov r0, #0
+	mcr p15, 0, r0, c7, c7, 0
+	bx lr
+.size ResetCaches, . - ResetCaches
+
+.section .text
+
+# Set page table address.  r0 = physical address, r1 = address space
+# ID, which is ignored--ARMv5 has no address space IDs
+.globl SetMMUBase
+.type SetMMUBase,%function
+SetMMUBase:
+	# The caches are indexed by virtual address, so they must be
+	# emptied before the mappings change underneath them
+1:	mrc p15, 0, r15, c7, c14, 3
+	bne 1b
+	mov r1, #0
+	mcr p15, 0, r1, c7, c5, 0
+	mcr p15, 0, r1, c7, c10, 4
+
+	# Set translation table base address
+	mcr p15, 0, r0, c2, c0, 0
+
+	# Flush TLB
+	mov r0, #0
+	mcr p15, 0, r0, c8, c5, 0
+
+	bx lr
+.size SetMMUBase, . - SetMMUBase
+
+# Flush the TLB, along with the caches, which may hold lines
+# for the old mappings
+.globl FlushTLB
+.type FlushTLB,%function
+FlushTLB:
+1:	mrc p15, 0, r15, c7, c14, 3
+	bne 1b
+	mov r0, #0
+	mcr p15, 0, r0, c7, c5, 0
+	mcr p15, 0, r0, c7, c10, 4
+	mcr p15, 0, r0, c8, c5, 0
+	bx lr
+.size FlushTLB, . - FlushTLB
+
+# Clean and invalidate the entire data cache, invalidate the
+# instruction cache, and drain the write buffer
+.globl FlushCaches
+.type FlushCaches,%function
+FlushCaches:
+1:	mrc p15, 0, r15, c7, c14, 3
+	bne 1b
+	mov r0, #0
+	mcr p15, 0, r0, c7, c5, 0
+	mcr p15, 0, r0, c7, c10, 4
+	bx lr
+.size FlushCaches, . - FlushCaches
+
+# Invalidate the TLB entry for a single address.  r0 = virtual address
+.globl InvalidateTLBEntry
+.type InvalidateTLBEntry,%function
+InvalidateTLBEntry:
+	mcr p15, 0, r0, c8, c7, 1
+	bx lr
+.size InvalidateTLBEntry, . - InvalidateTLBEntry
+
+# Set the Fast Context Switch Extension process ID.  r0 = PID, in bits
+# [31:25].  Cache and TLB contents are tagged with relocated addresses,
+# so nothing needs to be flushed.
+.globl SetFCSEPID
+.type SetFCSEPID,%function
+SetFCSEPID:
+	mcr p15, 0, r0, c13, c0, 0
+	bx lr
+.size SetFCSEPID, . - SetFCSEPID
+
+# Set the domain access control register.  r0 = two bits of access for each
+# of the 16 domains.  Permissions are checked on every access, so nothing
+# needs to be flushed.
+.globl SetDomainAccess
+.type SetDomainAccess,%function
+SetDomainAccess:
+	mcr p15, 0, r0, c3, c0, 0
+	bx lr
+.size SetDomainAccess, . - SetDomainAccess
@@ -0,0 +1,111 @@
+# ARMv7 memory management and cache functions.  The data cache on these
+# cores is physically indexed, and non-global TLB entries are tagged with
+# an address space ID, so neither needs to be emptied when the mappings
+# change.
+
+.section .low
+
+# Discard anything left in the caches, branch predictor and TLB from
+# before reset.  Called with the MMU off.
+.globl ResetCaches
+.type ResetCaches,%function
+ResetCaches:
+	push {r4-r6}
+
+	# Read the geometry of the level 1 data cache
+	mov r0, #0
+	mcr p15, 2, r0, c0, c0, 0
+	isb
+	mrc p15, 1, r0, c0, c0, 0
+
+	# r1 = log2 of line size, r2 = highest way, r3 = highest set,
+	# r4 = position of the way field
+	and r1, r0, #7
+	add r1, r1, #4
+	movw r2, #0x3ff
+	and r2, r2, r0, lsr #3
+	movw r3, #0x7fff
+	and r3, r3, r0, lsr #13
+	clz r4, r2
+
+	# Invalidate every line by set and way
+1:	mov r5, r2
+2:	lsl r6, r5, r4
+	orr r6, r6, r3, lsl r1
+	mcr p15, 0, r6, c7, c6, 2
+	subs r5, r5, #1
+	bge 2b
+	subs r3, r3, #1
+	bge 1b
+
+	mov r0, #0
+	mcr p15, 0, r0, c7, c5, 0
+	mcr p15, 0, r0, c7, c5, 6
+	mcr p15, 0, r0, c8, c7, 0
+	dsb
+	isb
+
+	pop {r4-r6}
+	bx lr
+.size ResetCaches, . - ResetCaches
+
+.section .text
+
+# Set page table address and address space ID.  r0 = physical address,
+# r1 = ASID.  Pass through the reserved ASID 0 while the table changes,
+# so that no TLB entry can pair the new ASID with the old table, or the
+# old ASID with the new table.
+.globl SetMMUBase
+.type SetMMUBase,%function
+SetMMUBase:
+	mov r2, #0
+	dsb
+	mcr p15, 0, r2, c13, c0, 1
+	isb
+	mcr p15, 0, r0, c2, c0, 0
+	isb
+	mcr p15, 0, r1, c13, c0, 1
+	isb
+	bx lr
+.size SetMMUBase, . - SetMMUBase
+
+# Load the kernel page table into TTBR1, and split the address space
+# so that TTBR0 only translates the bottom 1GB, below USER_END
+# (TTBCR.N = 2).  r0 = physical address
+.globl SetKernelMMUBase
+.type SetKernelMMUBase,%function
+SetKernelMMUBase:
+	mcr p15, 0, r0, c2, c0, 1
+	mov r1, #2
+	mcr p15, 0, r1, c2, c0, 2
+	isb
+	bx lr
+.size SetKernelMMUBase, . - SetKernelMMUBase
+
+# Flush the entire TLB, for all address space IDs
+.globl FlushTLB
+.type FlushTLB,%function
+FlushTLB:
+	mov r0, #0
+	dsb
+	mcr p15, 0, r0, c8, c7, 0
+	mcr p15, 0, r0, c7, c5, 6
+	dsb
+	isb
+	bx lr
+.size FlushTLB, . - FlushTLB
+
+# Invalidate the TLB entry for a single address.  r0 = virtual address
+# in bits [31:12], and address space ID in bits [7:0].  Global entries
+# match regardless of address space ID.
+.globl InvalidateTLBEntry
+.type InvalidateTLBEntry,%function
+InvalidateTLBEntry:
+	dsb
+	mcr p15, 0, r0, c8, c7, 1
+	mov r0, #0
+	mcr p15, 0, r0, c7, c5, 6
+	dsb
+	isb
+	bx lr
+.size InvalidateTLBEntry, . - InvalidateTLBEntry
@@ -0,0 +1,38 @@
+#ifndef BOARD_H
+#define BOARD_H
+
+#include "Page.hpp"
+
+// Board-specific device addresses.  The build selects the board, and
+// defines one of the BOARD_* symbols below.
+
+#if defined(BOARD_VEXPRESS_A9)
+
+//! Physical address of the Cortex-A9 private peripheral region, which holds the GIC
+#define BOARD_IO_PADDR 0x1e000000
+
+//! Kernel address of the private peripheral region.  Physical memory is
+//! only mapped from the start of RAM, so this region gets a section of its own.
+#define BOARD_IO_VADDR 0xfe000000
+
+//! Convert the physical address of a device register to a kernel address
+#define IO_PADDR_TO_VADDR(paddr) ((char*)(paddr) - BOARD_IO_PADDR + BOARD_IO_VADDR)
+
+//! GIC CPU interface
+#define BOARD_GIC_CPU_PADDR (BOARD_IO_PADDR + 0x100)
+
+//! GIC distributor
+#define BOARD_GIC_DIST_PADDR (BOARD_IO_PADDR + 0x1000)
+
+#else
+
+//! Convert the physical address of a device register to a kernel address.
+//! RAM starts at 0, so devices are covered by the mapping of physical memory.
+#define IO_PADDR_TO_VADDR(paddr) PADDR_TO_VADDR(paddr)
+
+//! Primary interrupt controller
+#define BOARD_PIC_PADDR 0x14000000
+
+#endif
+
+#endif
@@ -3,6 +3,7 @@
 #include "Sched.hpp"
 #include "Object.hpp"
 #include "Process.hpp"
+#include "AddressSpace.hpp"
 
 //! Slab allocator for objects
 Slab<Channel> Channel::sSlab;
@@ -118,7 +119,8 @@ Message *Channel::receive(struct MessageHeader *recvMsg, unsigned *targetData)
 
 	// Read the message contents into this task's address space
 	message->read(recvMsg);
-	*targetData = message->targetData();
+	unsigned data = message->targetData();
+	AddressSpace::memcpy(Sched::current()->process()->addressSpace(), targetData, 0, &data, sizeof(data));
 
 	if(message->type() == Message::TypeMessage) {
 		// Received message was a normal message.  Mark the sender as reply-blocked,
@@ -3,12 +3,19 @@
 #include "MemArea.hpp"
 #include "Object.hpp"
 #include "AddressSpace.hpp"
+#include "InitFs.hpp"
+#include "Page.hpp"
+#include "AsmFuncs.hpp"
+
+#include <kernel/include/InitFsFmt.h>
 
 #include <lib/shared/include/Name.h>
 #include <lib/shared/include/IO.h>
 
 #include <string.h>
 
+#include <algorithm>
+
 // Constants and types below are lifted directly from the ELF specification
 
 typedef unsigned int Elf32_Addr;
@@ -69,17 +76,93 @@ typedef struct {
 	Elf32_Word		p_align;
 } Elf32_Phdr;
 
+// Map a segment whose file data is already present in kernel memory.  Whole
+// pages of file data are shared with the kernel instead of being copied; the
+// MemAreaPages copy-on-write machinery takes care of any writes to them.
+static void mapSegment(AddressSpace *space, unsigned vaddr, char *fileData, unsigned fileSize, unsigned memSize)
+{
+	// File data past the end of the segment has nowhere to go
+	fileSize = std::min(fileSize, memSize);
+
+	// Add a memory area for the segment
+	unsigned aligned = PAGE_ADDR_ROUND_DOWN(vaddr);
+	unsigned skip = vaddr - aligned;
+	MemAreaPages *area = new MemAreaPages(memSize + skip);
+
+	// If the file data lines up with page boundaries in the same way as
+	// the segment, share every page that is entirely file data
+	char *fileStart = fileData - skip;
+	unsigned sharedSize = 0;
+	if(((unsigned)fileStart & ~PAGE_MASK) == 0) {
+		int sharedPages = std::min((int)((fileSize + skip) >> PAGE_SHIFT), area->numPages());
+		for(int i=0; i<sharedPages; i++) {
+			area->setPage(i, Page::fromVAddr(fileStart + (i << PAGE_SHIFT)));
+		}
+		sharedSize = sharedPages << PAGE_SHIFT;
+	}
+
+	if(!space->map(area, (void*)vaddr, 0, area->size())) {
+		return;
+	}
+
+	// Copy whatever file data could not be shared.  The rest of the area
+	// is zero-filled on demand.
+	unsigned copyStart = std::max(vaddr, aligned + sharedSize);
+	unsigned copyEnd = vaddr + fileSize;
+	if(copyStart < copyEnd) {
+		// Untouched pages are mapped to the shared zero page, which the
+		// kernel could write straight through, so copy by physical address.
+		// This also leaves the data in memory, ready to be fetched as code.
+		AddressSpace::memcpy(space, (void*)copyStart, 0, fileData + (copyStart - vaddr), copyEnd - copyStart);
+		InvalidateICache();
+	}
+}
+
+// Load an executable from the InitFS.  If mkinitfs laid out its segments
+// ahead of time, no ELF parsing is needed at all.
+static Elf::Entry loadInitFs(AddressSpace *space, struct InitFsFileHeader *header)
+{
+	if(header->numSegments > 0) {
+		for(int i=0; i<header->numSegments; i++) {
+			struct InitFsSegment *segment = &header->segments[i];
+			mapSegment(space, segment->vaddr, (char*)header + segment->offset, segment->fileSize, segment->memSize);
+		}
+
+		return (Elf::Entry)header->entry;
+	}
+
+	char *data = (char*)header + header->dataOffset;
+	Elf32_Ehdr *hdr = (Elf32_Ehdr*)data;
+	Elf32_Phdr *phdrs = (Elf32_Phdr*)(data + hdr->e_phoff);
+
+	for(int i=0; i<hdr->e_phnum; i++) {
+		if(phdrs[i].p_type != PT_LOAD) {
+			continue;
+		}
+
+		mapSegment(space, phdrs[i].p_vaddr, data + phdrs[i].p_offset, phdrs[i].p_filesz, phdrs[i].p_memsz);
+	}
+
+	return (Elf::Entry)hdr->e_entry;
+}
+
 /*!
  * \brief Load an ELF file into an address space
  * \param space Address space
- * \param data ELF file data
- * \param size Size of data
+ * \param name Name of ELF file
  */
 Elf::Entry Elf::load(AddressSpace *space, const char *name)
 {
 	Elf32_Ehdr hdr;
 	int obj;
 
+	// Executables in the InitFS are already in kernel memory, so map them
+	// directly rather than reading them through the file server
+	struct InitFsFileHeader *header = InitFs::lookupHeader(name);
+	if(header) {
+		return loadInitFs(space, header);
+	}
+
 	// World's stupidest ELF loader.  Loop across program headers and
 	// copy each into the address space
 	obj = Name_Open(name);
@@ -97,12 +180,14 @@ Elf::Entry Elf::load(AddressSpace *space, const char *name)
 		// Add a memory area for each program header
 		int aligned = PAGE_ADDR_ROUND_DOWN(phdrs[i].p_vaddr);
 		MemArea *area = new MemAreaPages(phdrs[i].p_memsz + phdrs[i].p_vaddr - aligned);
-		space->map(area, (void*)phdrs[i].p_vaddr, 0, area->size());
+		if(!space->map(area, (void*)phdrs[i].p_vaddr, 0, area->size())) {
+			continue;
+		}
 
-		// Copy the data into the section, and zero-init the space at the end
+		// Copy the data into the section.  The area is already zero-filled,
+		// so the space at the end needs no further initialization.
 		File_Seek(obj, phdrs[i].p_offset);
-		File_Read(obj, (void*)phdrs[i].p_vaddr, phdrs[i].p_filesz);
-		memset((void*)(phdrs[i].p_vaddr + phdrs[i].p_filesz), 0, phdrs[i].p_memsz - phdrs[i].p_filesz);
+		File_Read(obj, (void*)phdrs[i].p_vaddr, std::min(phdrs[i].p_filesz, phdrs[i].p_memsz));
 	}
 
 	Object_Release(obj);
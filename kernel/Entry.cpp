@@ -7,6 +7,7 @@
 #include "Process.hpp"
 #include "Object.hpp"
 #include "InitFs.hpp"
+#include "AddressSpace.hpp"
 
 #include "include/KernelFmt.h"
 #include "include/ProcessFmt.h"
@@ -24,6 +25,7 @@ extern "C" {
 	void Entry();
 	int SysEntry(enum Syscall code, unsigned int arg0, unsigned int arg1, unsigned int arg2, unsigned int arg3);
 	void IRQEntry();
+	int PageFaultEntry(void *vaddr);
 	void AbortEntry();
 }
 
@@ -57,14 +59,18 @@ void Entry()
 	Kernel::init();
 	Interrupt::init();
 
+	// Set up the userspace server.  It does not begin handling requests
+	// until it is run below.
+	Server server;
+
 	// Start the InitFs file server, to serve up files from the
-	// built-in filesystem that is compiled into the kernel
-	InitFs initfs;
+	// built-in filesystem that is compiled into the kernel.  File mappings
+	// are handed out through the userspace server.
+	InitFs initfs(&server);
 	initfs.start();
 
-	// Kernel initialization is now complete.  Set up the userspace server, and the first userspace process
-	Server server;
-	int obj = server.startUserProcess("/boot/name\0/boot/init\0\0", OBJECT_INVALID, OBJECT_INVALID, OBJECT_INVALID, initfs.object());
+	// Kernel initialization is now complete.  Start the first userspace process
+	int obj = server.startUserProcess("/boot/name\0/boot/init\0\0", OBJECT_INVALID, OBJECT_INVALID, OBJECT_INVALID, initfs.object(), KERNEL_SPAWN_FCSE | KERNEL_SPAWN_MERGEABLE, 0);
 	Object_Release(obj);
 
 	// Start userspace.  This call never returns.
@@ -87,6 +93,24 @@ void IRQEntry()
 	Interrupt::dispatch();
 }
 
+/*!
+ * \brief Page fault entry point for C++ code, called from assembly shim in abort mode
+ * \param vaddr Faulting address
+ * \return 1 if the fault was resolved and the access should be retried, 0 otherwise
+ */
+int PageFaultEntry(void *vaddr)
+{
+	// The faulting access was made through the currently active page table,
+	// which belongs to the current task's effective address space
+	AddressSpace *addressSpace = Sched::current()->effectiveAddressSpace();
+	if(!addressSpace) {
+		return 0;
+	}
+
+	// Data aborts report the address after FCSE relocation
+	return addressSpace->handleFault(addressSpace->vaddrFromMVA(vaddr)) ? 1 : 0;
+}
+
 /*!
  * \brief Abort entry point for C++ code, called from assembly shim
  */
@@ -23,12 +23,20 @@ EntryAsm:
 	ldr r0, domainValue
 	mcr p15, 0, r0, c3, c0, 0
 
+	# Discard anything left in the caches from before reset
+	bl ResetCaches
+
 	# This is it.  The page tables are all set, so set high
-	# exception vectors, and enable the MMU.
+	# exception vectors, and enable the MMU along with the
+	# instruction and data caches.
 	mrc p15, 0, r0, c1, c0, 0
 	mov r1, #1
 	lsl r1, #13
 	orr r0, r1
+	mov r1, #1
+	lsl r1, #12
+	orr r0, r1
+	orr r0, #4
 	orr r0, #1
 	mcr p15, 0, r0, c1, c0, 0
 
@@ -43,6 +51,12 @@ EntryAsm:
 	msr cpsr, r0
 	ldr sp, =IRQStack
 	add sp, #4096
+
+	# Set up abort-mode stack
+	mov r0, #0xd7
+	msr cpsr, r0
+	ldr sp, =AbortStack
+	add sp, #4096
 	mov r0, #0xd3
 	msr cpsr, r0
 
@@ -50,7 +64,7 @@ EntryAsm:
 	ldr r0, =Entry
 	bx r0
 memOffset:
-	.word 0xC0000000
+	.word __MemOffset
 domainValue:
 	.word 0x55555555
 
@@ -102,9 +116,34 @@ vecSWI:
 	movs pc, lr
 
 vecPrefetchAbort:
+	# Prefetch abort.  Back lr up to the faulting instruction, which
+	# is also the faulting address.
+	sub lr, #4
+	stmfd sp!, {r0-r3, ip, lr}
+	mov r0, lr
+	b abortCommon
+
 vecDataAbort:
-	# Abort entry.  Switch back to Supervisor mode, and transfer
-	# to C++ abort handler
+	# Data abort.  Back lr up to the faulting instruction, and fetch
+	# the faulting address from the MMU.
+	sub lr, #8
+	stmfd sp!, {r0-r3, ip, lr}
+	mrc p15, 0, r0, c6, c0, 0
+
+abortCommon:
+	# Give the C++ page fault handler a chance to resolve the fault
+	ldr ip, PageFaultEntryAddr
+	blx ip
+	cmp r0, #0
+	ldmfd sp!, {r0-r3, ip, lr}
+	beq abortKill
+
+	# Fault was resolved.  Retry the faulting instruction.
+	movs pc, lr
+
+abortKill:
+	# Fault could not be resolved.  Switch back to Supervisor mode, and
+	# transfer to C++ abort handler
 	mrs r2, cpsr
 	bic r2, #0xf
 	orr r2, #0x3
@@ -133,5 +172,7 @@ IRQEntryAddr:
 	.word IRQEntry
 AbortEntryAddr:
 	.word AbortEntry
+PageFaultEntryAddr:
+	.word PageFaultEntry
 .globl vectorEnd
 vectorEnd:
@@ -7,6 +7,8 @@
 #include "Task.hpp"
 #include "Process.hpp"
 #include "Log.hpp"
+#include "Server.hpp"
+#include "MemArea.hpp"
 
 #include <kernel/include/InitFsFmt.h>
 #include <kernel/include/NameFmt.h>
@@ -26,26 +28,76 @@ extern char __InitFsEnd[];
 // Path at which to register the InitFS
 #define PREFIX "/boot"
 
-static void *lookup(const char *name, int *size)
+// Number of files in the initfs
+static int numFiles()
 {
-	// Search through the initfs searching for a matching file
-	struct InitFsFileHeader *header = reinterpret_cast<struct InitFsFileHeader*>(__InitFsStart);
-	while(reinterpret_cast<void*>(header) < reinterpret_cast<void*>(__InitFsEnd)) {
-		if(!strcmp(header->name, name)) {
+	return reinterpret_cast<struct InitFsIndex*>(__InitFsStart)->numFiles;
+}
+
+// Directory index entry, in sorted order
+static struct InitFsIndexEntry *indexEntry(int n)
+{
+	struct InitFsIndexEntry *entries = reinterpret_cast<struct InitFsIndexEntry*>(__InitFsStart + sizeof(struct InitFsIndex));
+	return &entries[n];
+}
+
+static struct InitFsFileHeader *lookupName(const char *name)
+{
+	// Binary search the sorted directory index for a matching file
+	int low = 0;
+	int high = numFiles() - 1;
+	while(low <= high) {
+		int mid = (low + high) / 2;
+		struct InitFsIndexEntry *entry = indexEntry(mid);
+		int cmp = strcmp(name, entry->name);
+
+		if(cmp == 0) {
 			// Filename matches
-			if(size) {
-				*size = header->size;
-			}
-			return reinterpret_cast<char*>(header) + sizeof(struct InitFsFileHeader);
+			return reinterpret_cast<struct InitFsFileHeader*>(__InitFsStart + entry->offset);
+		} else if(cmp < 0) {
+			high = mid - 1;
+		} else {
+			low = mid + 1;
 		}
-
-		// Skip to the next file record
-		header = reinterpret_cast<struct InitFsFileHeader*>(reinterpret_cast<char*>(header) + sizeof(struct InitFsFileHeader) + header->size);
 	}
 
 	return 0;
 }
 
+/*!
+ * \brief Look up a file record by its full path
+ * \param path Path, including the InitFS prefix
+ * \return File header, or 0 if not found
+ */
+struct InitFsFileHeader *InitFs::lookupHeader(const char *path)
+{
+	if(strncmp(path, PREFIX "/", strlen(PREFIX "/")) != 0) {
+		return 0;
+	}
+
+	return lookupName(path + strlen(PREFIX "/"));
+}
+
+/*!
+ * \brief Look up a file by its full path
+ * \param path Path, including the InitFS prefix
+ * \param size Size of file
+ * \return Pointer to file data in kernel memory, or 0 if not found
+ */
+void *InitFs::lookup(const char *path, int *size)
+{
+	struct InitFsFileHeader *header = lookupHeader(path);
+	if(!header) {
+		return 0;
+	}
+
+	if(size) {
+		*size = header->size;
+	}
+
+	return reinterpret_cast<char*>(header) + header->dataOffset;
+}
+
 // Open file information structure
 struct FileInfo {
 	void *data;
@@ -54,7 +106,7 @@ struct FileInfo {
 };
 
 struct DirInfo {
-	struct InitFsFileHeader *header;
+	int entry;
 };
 
 enum InfoType {
@@ -74,11 +126,13 @@ static Slab<Info> infoSlab;
 
 /*!
  * \brief Constructor
+ * \param server Process server
  */
-InitFs::InitFs()
+InitFs::InitFs(Server *server)
 {
 	mChannel = Channel_Create();
 	mObject = Object_Create(mChannel, 0);
+	mServer = server;
 }
 
 /*!
@@ -99,6 +153,27 @@ int InitFs::object()
 	return mObject;
 }
 
+// Create a memory object mapping part of a file.  InitFS files are page-aligned
+// and padded out with zeroes to a page boundary, so their pages can be shared
+// directly, with any writes going to private copies.  Each request gets an
+// area of its own, so that writes made through one mapping are never seen by
+// another.
+int InitFs::mapFile(struct FileInfo *file, int offset, int size)
+{
+	if(offset < 0 || offset >= file->size || (offset & ~PAGE_MASK) != 0 || size <= 0) {
+		return OBJECT_INVALID;
+	}
+
+	size = std::min(size, file->size - offset);
+	MemAreaPages *area = new MemAreaPages(size);
+	char *data = reinterpret_cast<char*>(file->data) + offset;
+	for(int i=0; i<area->numPages(); i++) {
+		area->setPage(i, Page::fromVAddr(data + (i << PAGE_SHIFT)));
+	}
+
+	return mServer->createMemObject(area);
+}
+
 void InitFs::serverStatic(void *param)
 {
 	InitFs *initfs = reinterpret_cast<InitFs*>(param);
@@ -147,7 +222,6 @@ void InitFs::server()
 						Log::printf("initfs: Open file %s\n", name);
 
 						// Look up the requested file name in the InitFS
-						name += strlen(PREFIX) + 1;
 						data = lookup(name, &size);
 						if(data) {
 							// File was found.  Create an object for the new
@@ -179,7 +253,7 @@ void InitFs::server()
 					if(strcmp(name, PREFIX) == 0) {
 						Info *info = infoSlab.allocate();
 						info->type = InfoTypeDir;
-						info->dir.header = reinterpret_cast<struct InitFsFileHeader*>(__InitFsStart);
+						info->dir.entry = 0;
 						obj = Object_Create(mChannel, (unsigned)info);
 					}
 
@@ -209,14 +283,28 @@ void InitFs::server()
 					break;
 				}
 
+				case IOMsgTypeMap:
+				{
+					int obj = OBJECT_INVALID;
+					if(info->type == InfoTypeFile) {
+						obj = mapFile(&info->file, msg.io.map.offset, msg.io.map.size);
+					}
+
+					Message_Replyh(m, 0, &obj, sizeof(obj), 0, 1);
+					if(obj != OBJECT_INVALID) {
+						Object_Release(obj);
+					}
+					break;
+				}
+
 				case IOMsgTypeReadDir:
 				{
 					IOMsgReadDirRet ret;
 					int status = 1;
-					if((void*)info->dir.header < (void*)__InitFsEnd){
+					if(info->dir.entry < numFiles()) {
 						status = 0;
-						strcpy(ret.name, info->dir.header->name);
-						info->dir.header = reinterpret_cast<struct InitFsFileHeader*>(reinterpret_cast<char*>(info->dir.header) + sizeof(struct InitFsFileHeader) + info->dir.header->size);
+						strcpy(ret.name, indexEntry(info->dir.entry)->name);
+						info->dir.entry++;
 					}
 					Message_Reply(m, status, &ret, sizeof(ret));
 					break;
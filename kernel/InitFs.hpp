@@ -2,23 +2,32 @@
 #define INIT_FS_H
 
 class Object;
+class Server;
+struct InitFsFileHeader;
+struct FileInfo;
 
 /*!
  * \brief The InitFS filesystem that is built into the kernel
  */
 class InitFs {
 public:
-	InitFs();
+	InitFs(Server *server);
 
 	int object();
 	void start();
 
+	static void *lookup(const char *path, int *size);
+	static struct InitFsFileHeader *lookupHeader(const char *path);
+
 private:
 	void server();
 	static void serverStatic(void *param);
 
+	int mapFile(struct FileInfo *file, int offset, int size);
+
 	int mObject;
 	int mChannel;
+	Server *mServer; //!< Process server, through which file mappings are handed out
 };
 
 #endif
@@ -3,9 +3,36 @@
 #include "Page.hpp"
 #include "List.hpp"
 #include "Object.hpp"
+#include "Board.hpp"
 
+#if defined(BOARD_VEXPRESS_A9)
+// 32 private interrupts, followed by the shared peripheral interrupts
+#define N_INTERRUPTS 96
+
+#define GIC_CPU_BASE (volatile unsigned*)IO_PADDR_TO_VADDR(BOARD_GIC_CPU_PADDR)
+#define GICC_CTLR (GIC_CPU_BASE + 0)
+#define GICC_PMR  (GIC_CPU_BASE + 1)
+#define GICC_IAR  (GIC_CPU_BASE + 3)
+#define GICC_EOIR (GIC_CPU_BASE + 4)
+
+#define GIC_DIST_BASE (volatile unsigned*)IO_PADDR_TO_VADDR(BOARD_GIC_DIST_PADDR)
+#define GICD_CTLR      (GIC_DIST_BASE + 0)
+#define GICD_ISENABLER (GIC_DIST_BASE + 0x40)
+#define GICD_ICENABLER (GIC_DIST_BASE + 0x60)
+#define GICD_ITARGETSR ((volatile unsigned char*)(GIC_DIST_BASE + 0x200))
+
+//! Interrupt ID returned when no interrupt is pending
+#define GIC_SPURIOUS 1023
+#else
 #define N_INTERRUPTS 32
 
+#define PIC_BASE (unsigned*)IO_PADDR_TO_VADDR((PAddr)BOARD_PIC_PADDR)
+#define PIC_IRQ_STATUS    (PIC_BASE + 0)
+#define PIC_IRQ_RAWSTAT   (PIC_BASE + 1)
+#define PIC_IRQ_ENABLESET (PIC_BASE + 2)
+#define PIC_IRQ_ENABLECLR (PIC_BASE + 3)
+#endif
+
 struct Subscription
 {
 	Object *object;
@@ -15,14 +42,18 @@ struct Subscription
 
 static Subscription subscriptions[N_INTERRUPTS];
 
-#define PIC_BASE (unsigned*)PADDR_TO_VADDR((PAddr)0x14000000)
-#define PIC_IRQ_STATUS    (PIC_BASE + 0)
-#define PIC_IRQ_RAWSTAT   (PIC_BASE + 1)
-#define PIC_IRQ_ENABLESET (PIC_BASE + 2)
-#define PIC_IRQ_ENABLECLR (PIC_BASE + 3)
-
 void Interrupt::init()
 {
+#if defined(BOARD_VEXPRESS_A9)
+	// Route all shared interrupts to this CPU, and let every priority through
+	for(int i=32; i<N_INTERRUPTS; i++) {
+		GICD_ITARGETSR[i] = 1;
+	}
+	*GICC_PMR = 0xf0;
+	*GICD_CTLR = 1;
+	*GICC_CTLR = 1;
+#endif
+
 	for(int i=0; i<N_INTERRUPTS; i++) {
 		subscribe(i, 0, 0, 0);
 	}
@@ -48,28 +79,58 @@ void Interrupt::subscribe(int irq, Object *object, unsigned type, unsigned value
 
 void Interrupt::mask(int irq)
 {
+#if defined(BOARD_VEXPRESS_A9)
+	GICD_ICENABLER[irq / 32] = 1 << (irq % 32);
+#else
 	*PIC_IRQ_ENABLECLR = 1 << irq;
+#endif
 }
 
 void Interrupt::unmask(int irq)
 {
+#if defined(BOARD_VEXPRESS_A9)
+	GICD_ISENABLER[irq / 32] = 1 << (irq % 32);
+#else
 	*PIC_IRQ_ENABLESET = 1 << irq;
+#endif
+}
+
+// Mask a pending interrupt, and pass it on to its subscriber.  The
+// subscriber unmasks it again once it has been serviced.
+static void deliver(int irq)
+{
+	if(subscriptions[irq].object) {
+		Interrupt::mask(irq);
+		int result = subscriptions[irq].object->post(subscriptions[irq].type, subscriptions[irq].value);
+		if(result == SysErrorObjectDead) {
+			Interrupt::subscribe(irq, 0, 0, 0);
+		}
+	}
 }
 
 void Interrupt::dispatch()
 {
+#if defined(BOARD_VEXPRESS_A9)
+	while(1) {
+		unsigned iar = *GICC_IAR;
+		unsigned irq = iar & 0x3ff;
+		if(irq == GIC_SPURIOUS) {
+			break;
+		}
+
+		if(irq < N_INTERRUPTS) {
+			deliver(irq);
+		}
+		*GICC_EOIR = iar;
+	}
+#else
 	unsigned status = *PIC_IRQ_STATUS;
 
 	for(int i=0; i<N_INTERRUPTS; i++) {
 		if(status & 0x1) {
-			if(subscriptions[i].object) {
-				mask(i);
-				int result = subscriptions[i].object->post(subscriptions[i].type, subscriptions[i].value);
-				if(result == SysErrorObjectDead) {
-					subscribe(i, 0, 0, 0);
-				}
-			}
+			deliver(i);
 		}
 		status >>= 1;
 	}
+#endif
 }
@@ -10,6 +10,8 @@
 #include "Process.hpp"
 #include "Task.hpp"
 #include "Channel.hpp"
+#include "AsmFuncs.hpp"
+#include "Board.hpp"
 
 #include <string.h>
 
@@ -17,6 +19,7 @@
 extern "C" {
 	__attribute__((aligned (PAGE_SIZE) )) char InitStack[PAGE_SIZE];
 	__attribute__((aligned (PAGE_SIZE) )) char IRQStack[PAGE_SIZE];
+	__attribute__((aligned (PAGE_SIZE) )) char AbortStack[PAGE_SIZE];
 	unsigned BuildInitPageTable();
 }
 
@@ -35,17 +38,10 @@ extern char vectorEnd[];
  */
 void Kernel::init()
 {
-	// Mark as in use all pages used by the kernel itself
-	Page *pages = Page::fromNumber(0);
-	for(int i=0; i<=Page::fromVAddr(&__KernelEnd)->number(); i++) {
-		pages[i].setFlags(Page::FlagsInUse);
-	}
-
-	// Now that we've pivoted to high addresses, lock out the low area of the address space
+	// Now that we've pivoted to high addresses, unmap the low area of the address space
 	PageTable *pageTable = new PageTable(Page::fromVAddr(initPageTable));
-	for(unsigned vaddr = 0; vaddr < KERNEL_START; vaddr += PageTable::SectionSize) {
-		pageTable->mapSection((void*)vaddr, 0, PageTable::PermissionNone);
-	}
+	pageTable->activate();
+	pageTable->unmap(0, KERNEL_START);
 
 	// Allocate a page to hold the vectors
 	Page *vectorPage = Page::alloc();
@@ -55,6 +51,10 @@ void Kernel::init()
 	pageTable->mapPage((void*)0xffff0000, vectorPage->paddr(), PageTable::PermissionRWPriv);
 	::memcpy(vector, vectorStart, (unsigned)vectorEnd - (unsigned)vectorStart);
 
+	// The vectors are fetched as instructions, so push them out of the data cache
+	CleanDCacheRange(vector, (unsigned)vectorEnd - (unsigned)vectorStart);
+	InvalidateICache();
+
 	// Construct the kernel address space and process out of the already-allocated page table
 	AddressSpace *addressSpace = new AddressSpace(pageTable);
 	sProcess = new Process(addressSpace);
@@ -118,16 +118,27 @@ __attribute__ ((section(".low"))) unsigned BuildInitPageTable()
 	// Identity-map the first portion of the virtual address space to physical memory
 	PAddr paddr = 0;
 	for(unsigned idx = 0; idx < (KERNEL_START >> PAGE_TABLE_SECTION_SHIFT); idx++) {
-		table[idx] = (paddr & PTE_SECTION_BASE_MASK) | PTE_L2_AP_ALL_READ_WRITE_PRIV | PTE_TYPE_SECTION;
+		table[idx] = (paddr & PTE_SECTION_BASE_MASK) | PTE_SECTION_AP_READ_WRITE_PRIV | PTE_TYPE_SECTION;
 		paddr += PageTable::SectionSize;
 	}
 
-	// Duplicate the mapping of physical memory into the high address range
-	paddr = 0;
+	// Duplicate the mapping of physical memory, from the start of RAM, into the high address range
+	paddr = RAM_START;
 	for(unsigned idx = (KERNEL_START >> PAGE_TABLE_SECTION_SHIFT); idx < PAGE_TABLE_SIZE; idx++) {
-		table[idx] = (paddr & PTE_SECTION_BASE_MASK) | PTE_L2_AP_ALL_READ_WRITE_PRIV | PTE_TYPE_SECTION;
+		table[idx] = (paddr & PTE_SECTION_BASE_MASK) | PTE_SECTION_AP_READ_WRITE_PRIV | PTE_TYPE_SECTION;
+
+		// RAM is cached write-back.  The rest of the physical address space
+		// holds devices, and must not be cached.
+		if(PADDR_IS_RAM(paddr)) {
+			table[idx] |= PTE_SECTION_CACHEABLE | PTE_SECTION_BUFFERABLE;
+		}
 		paddr += PageTable::SectionSize;
 	}
 
+#ifdef BOARD_IO_VADDR
+	// Devices which lie outside of the mapping of physical memory get a section of their own
+	table[BOARD_IO_VADDR >> PAGE_TABLE_SECTION_SHIFT] = (BOARD_IO_PADDR & PTE_SECTION_BASE_MASK) | PTE_SECTION_AP_READ_WRITE_PRIV | PTE_TYPE_SECTION;
+#endif
+
 	return VADDR_TO_PADDR(initPageTable);
 }
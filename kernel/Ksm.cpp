@@ -0,0 +1,228 @@
+#include "Ksm.hpp"
+
+#include "AddressSpace.hpp"
+#include "PageTable.hpp"
+#include "MemArea.hpp"
+#include "Page.hpp"
+#include "AsmFuncs.hpp"
+#include "Log.hpp"
+
+#include <string.h>
+
+//! Address spaces which have opted in
+List<AddressSpace> Ksm::sSpaces;
+
+//! Address space being scanned
+AddressSpace *Ksm::sSpace;
+
+//! Next address to scan
+unsigned Ksm::sVAddr;
+
+//! True while a pass is under way
+bool Ksm::sScanning;
+
+//! True if another pass is needed
+bool Ksm::sRescan;
+
+//! True if any pages were merged in this pass
+bool Ksm::sMerged;
+
+//! Pages which others can be merged into, indexed by hash
+Ksm::StableEntry Ksm::sStable[STABLE_SIZE];
+
+//! Hashes seen so far, indexed by hash
+Ksm::UnstableEntry Ksm::sUnstable[UNSTABLE_SIZE];
+
+// Hash the contents of a page, reading it through the kernel's mapping
+static unsigned hashPage(Page *page)
+{
+	unsigned *data = (unsigned*)page->vaddr();
+	unsigned hash = 2166136261u;
+	for(int i=0; i<PAGE_SIZE / sizeof(unsigned); i++) {
+		hash = (hash ^ data[i]) * 16777619u;
+	}
+
+	// Leave nothing behind in the cache under the kernel address, which
+	// could go stale if the page is written through its user address
+	AddressSpace::endKernelAccess(data, PAGE_SIZE);
+	return hash;
+}
+
+// Compare the contents of two pages
+static bool samePage(Page *a, Page *b)
+{
+	bool same = (memcmp(a->vaddr(), b->vaddr(), PAGE_SIZE) == 0);
+	AddressSpace::endKernelAccess(a->vaddr(), PAGE_SIZE);
+	AddressSpace::endKernelAccess(b->vaddr(), PAGE_SIZE);
+
+	return same;
+}
+
+/*!
+ * \brief Opt an address space in to merging
+ * \param space Address space
+ */
+void Ksm::addSpace(AddressSpace *space)
+{
+	sSpaces.addTail(space);
+	wake();
+}
+
+/*!
+ * \brief Remove an address space which is being destroyed
+ * \param space Address space
+ */
+void Ksm::removeSpace(AddressSpace *space)
+{
+	if(sSpace == space) {
+		sSpace = sSpaces.next(space);
+		sVAddr = 0;
+	}
+
+	sSpaces.remove(space);
+}
+
+/*!
+ * \brief Scan a single page.  Called from the scheduler's idle loop.
+ * \return True if a page was scanned, false if there was nothing to do
+ */
+bool Ksm::scan()
+{
+	if(!sScanning) {
+		return false;
+	}
+
+	if(!sSpace) {
+		sSpace = sSpaces.head();
+		sVAddr = 0;
+		if(!sSpace) {
+			endPass();
+			return false;
+		}
+	}
+
+	// Find the next mapping at or above the scan address.  Once there are
+	// none left, move on to the next address space.
+	struct Mapping *mapping = sSpace->nextMapping((void*)sVAddr);
+	if(!mapping) {
+		sSpace = sSpaces.next(sSpace);
+		sVAddr = 0;
+		if(!sSpace) {
+			endPass();
+		}
+		return true;
+	}
+
+	unsigned mapStart = (unsigned)mapping->vaddr;
+	if(sVAddr < mapStart) {
+		sVAddr = mapStart;
+	}
+
+	// Only areas mapped in a single place are scanned, since their pages are
+	// remapped through that one page table.  Shared memory areas can gain
+	// more mappings at any time, through a fork, so they are never scanned.
+	MemAreaPages *area = mapping->area->asPages();
+	if(!area || !area->mergeable() || mapping->area->refCount() != 1) {
+		sVAddr = mapStart + mapping->size;
+		return true;
+	}
+
+	int idx = (mapping->offset + (sVAddr - mapStart)) >> PAGE_SHIFT;
+	if(idx < area->numPages() && area->page(idx)) {
+		scanPage(sSpace, area, idx, (void*)sVAddr);
+	}
+
+	sVAddr += PAGE_SIZE;
+	return true;
+}
+
+// Hash a page, and merge it into an identical stable page if there is one.
+// Otherwise, if another page has been seen with the same hash, freeze this
+// one as a stable page, so that the other can be merged into it when the
+// scan comes back around to it.
+void Ksm::scanPage(AddressSpace *space, MemAreaPages *area, int idx, void *vaddr)
+{
+	Page *page = area->page(idx);
+
+	// Pages which are already shared, whether merged, copy-on-write or the
+	// zero page, are left alone
+	if(page->refCount() != 1) {
+		return;
+	}
+
+	// Bring the page up to date in memory before reading it through the
+	// kernel's mapping
+	space->beginKernelAccess(vaddr, PAGE_SIZE);
+	unsigned hash = hashPage(page);
+
+	StableEntry *stable = &sStable[hash % STABLE_SIZE];
+	if(stable->page && stable->page->refCount() == 1) {
+		// Nothing but this table refers to the page any more
+		stable->page->free();
+		stable->page = 0;
+	}
+
+	if(stable->page && stable->hash == hash && samePage(stable->page, page)) {
+		// Point the mapping at the stable page before the area lets go of its
+		// own.  Stable pages are always mapped read-only, so a write to either
+		// one later on takes a copy.
+		space->pageTable()->mapPage(space->mva(vaddr), stable->page->paddr(), PageTable::PermissionRO);
+		area->setPage(idx, stable->page);
+		sMerged = true;
+		return;
+	}
+
+	UnstableEntry *unstable = &sUnstable[hash % UNSTABLE_SIZE];
+	if(!stable->page && unstable->hash == hash && unstable->page != page) {
+		// Freeze the page.  With the extra reference, a write through this
+		// mapping takes a copy instead of changing it.
+		space->pageTable()->mapPage(space->mva(vaddr), page->paddr(), PageTable::PermissionRO);
+		page->ref();
+		stable->hash = hash;
+		stable->page = page;
+		sRescan = true;
+		return;
+	}
+
+	unstable->hash = hash;
+	unstable->page = page;
+}
+
+// Finish a pass over all address spaces
+void Ksm::endPass()
+{
+	// Release stable pages which nothing else refers to any more
+	for(int i=0; i<STABLE_SIZE; i++) {
+		if(sStable[i].page && sStable[i].page->refCount() == 1) {
+			sStable[i].page->free();
+			sStable[i].page = 0;
+		}
+	}
+
+	if(sMerged) {
+		Log::printf("ksm: %i bytes saved\n", bytesSaved());
+	}
+
+	sScanning = sRescan;
+	sRescan = false;
+	sMerged = false;
+}
+
+/*!
+ * \brief Compute the memory saved by merging
+ *
+ * Each stable page stands in for as many pages as there are references on
+ * it, apart from the one held by the merge table itself.
+ * \return Bytes saved
+ */
+unsigned int Ksm::bytesSaved()
+{
+	unsigned int saved = 0;
+	for(int i=0; i<STABLE_SIZE; i++) {
+		if(sStable[i].page && sStable[i].page->refCount() > 2) {
+			saved += (sStable[i].page->refCount() - 2) * PAGE_SIZE;
+		}
+	}
+
+	return saved;
+}
@@ -0,0 +1,64 @@
+#ifndef KSM_H
+#define KSM_H
+
+#include "List.hpp"
+
+class AddressSpace;
+class MemAreaPages;
+class Page;
+
+/*!
+ * \brief Kernel same-page merging
+ *
+ * During idle time, the memory of address spaces which have opted in is
+ * scanned one page at a time, and pages with identical contents are merged
+ * into a single copy-on-write page.
+ */
+class Ksm {
+public:
+	static bool scan();
+	static void addSpace(AddressSpace *space);
+	static void removeSpace(AddressSpace *space);
+
+	/*!
+	 * \brief Request another pass over the opted-in address spaces
+	 */
+	static void wake() { sScanning = true; }
+
+	static unsigned int bytesSaved();
+
+private:
+	/*!
+	 * \brief A page whose contents are frozen, and into which other pages can be merged
+	 */
+	struct StableEntry {
+		unsigned hash; //!< Hash of page contents
+		Page *page; //!< Page, on which the entry holds a reference
+	};
+
+	/*!
+	 * \brief A hash which has been seen before.  The page is only kept to
+	 *        tell it apart from others, and is never dereferenced.
+	 */
+	struct UnstableEntry {
+		unsigned hash; //!< Hash of page contents
+		Page *page; //!< Page which had the hash
+	};
+
+	static const int STABLE_SIZE = 512;
+	static const int UNSTABLE_SIZE = 1024;
+
+	static void scanPage(AddressSpace *space, MemAreaPages *area, int idx, void *vaddr);
+	static void endPass();
+
+	static List<AddressSpace> sSpaces; //!< Address spaces which have opted in
+	static AddressSpace *sSpace; //!< Address space being scanned
+	static unsigned sVAddr; //!< Next address to scan
+	static bool sScanning; //!< True while a pass is under way
+	static bool sRescan; //!< True if another pass is needed to finish off merges begun in this one
+	static bool sMerged; //!< True if any pages were merged in this pass
+	static StableEntry sStable[STABLE_SIZE];
+	static UnstableEntry sUnstable[UNSTABLE_SIZE];
+};
+
+#endif
@@ -1,13 +1,44 @@
 #include "MemArea.hpp"
 
 #include "PageTable.hpp"
+#include "AsmFuncs.hpp"
+
+#include <string.h>
 
 //! Slab allocator
 Slab<MemAreaPages> MemAreaPages::sSlab;
 
+//! Slab allocator
+Slab<MemAreaStack> MemAreaStack::sSlab;
+
+//! Slab allocator
+Slab<MemAreaShared> MemAreaShared::sSlab;
+
 //! Slab allocator
 Slab<MemAreaPhys> MemAreaPhys::sSlab;
 
+//! Page of zeroes, mapped read-only in place of pages which have not yet been written
+static Page *sZeroPage;
+
+// Get the shared zero page.  It carries an extra reference which is never
+// dropped, so that it always looks shared, and kernel writes through
+// AddressSpace::translate fault in a private page instead.
+static Page *zeroPage()
+{
+	if(!sZeroPage) {
+		sZeroPage = Page::allocZeroed();
+		sZeroPage->ref();
+	}
+
+	return sZeroPage;
+}
+
+//! Order of a block of pages which fills a section
+#define SECTION_ORDER 8
+
+//! Order of a block of pages which fills a large page
+#define LARGE_PAGE_ORDER 4
+
 /*!
  * \brief Constructor
  * \param size Size of area
@@ -20,21 +51,68 @@ MemArea::MemArea(int size)
 /*!
  * \brief Expand a memory area
  * \param newSize New size
+ * \return True if the area was expanded, false if memory ran out.  The area
+ *         keeps its old size on failure.
  */
-void MemArea::expand(int newSize)
+bool MemArea::expand(int newSize)
 {
 	int newSizeRounded = PAGE_SIZE_ROUND_UP(newSize);
 
-	doExpand(newSizeRounded);
+	// Areas never shrink
+	if(newSizeRounded <= mSize) {
+		return true;
+	}
+
+	if(!doExpand(newSizeRounded)) {
+		return false;
+	}
 
-	mSize = newSize;
+	mSize = newSizeRounded;
+	return true;
 }
 
 /*!
  * \brief Perform an expand operation
  * \param newSize New size
+ * \return True on success
  */
-void MemArea::doExpand(int newSize)
+bool MemArea::doExpand(int newSize)
+{
+	// Placeholder for subclasses
+	return true;
+}
+
+/*!
+ * \brief Resolve a fault on a page of this area
+ * \param table Page table through which the fault occurred
+ * \param vaddr Page-aligned virtual address of the fault
+ * \param offset Offset within area of the faulting page
+ * \param mapStart Offset within area of the start of the faulting mapping
+ * \param mapEnd Offset within area of the end of the faulting mapping
+ * \return True if the page was mapped, false if the access was invalid
+ */
+bool MemArea::fault(PageTable *table, void *vaddr, unsigned int offset, unsigned int mapStart, unsigned int mapEnd)
+{
+	// Areas map everything up front by default, so any fault is invalid
+	return false;
+}
+
+/*!
+ * \brief Create a copy of this area, for use in a cloned address space
+ * \return New area
+ */
+MemArea *MemArea::clone()
+{
+	// By default, the clone simply shares the original area
+	return this;
+}
+
+/*!
+ * \brief Discard the contents of a range of the area, which is no longer mapped
+ * \param offset Offset within area
+ * \param size Size of range
+ */
+void MemArea::discard(unsigned int offset, unsigned int size)
 {
 	// Placeholder for subclasses
 }
@@ -46,53 +124,422 @@ void MemArea::onLastRef()
 
 /*!
  * \brief Constructor
+ *
+ * If there is not enough memory for the page array, the area is left with
+ * a size of 0, and any attempt to map it fails.
  * \param size Size of area
+ * \param largePages True to allocate whole 64KB and 1MB blocks as soon as any
+ *        part of them is touched, for areas which are known to be used densely
  */
-MemAreaPages::MemAreaPages(int size)
- : MemArea(size)
+MemAreaPages::MemAreaPages(int size, bool largePages)
+ : MemArea(0)
 {
-	// Allocate the appropriate number of pages
-	mPages = Page::allocMulti(MemArea::size() >> PAGE_SHIFT);
+	mLargePages = largePages;
+	memset(mInlinePages, 0, sizeof(mInlinePages));
+	mPages = mInlinePages;
+	mNumPages = 0;
+	mPageArrayBlock = 0;
+	mPageArrayOrder = 0;
+
+	expand(size);
 }
 
 MemAreaPages::~MemAreaPages()
 {
-	for(Page *page = mPages.head(); page != 0; page = mPages.next(page)) {
-		page->free();
+	// Drop this area's reference on each of its pages
+	for(int i=0; i<mNumPages; i++) {
+		if(mPages[i]) {
+			mPages[i]->free();
+		}
+	}
+
+	if(mPageArrayBlock) {
+		for(int i=0; i<(1 << mPageArrayOrder); i++) {
+			mPageArrayBlock[i].free();
+		}
 	}
 }
 
 void MemAreaPages::map(PageTable *table, void *vaddr, unsigned int offset, unsigned int size)
 {
 	unsigned v = (unsigned)vaddr;
-	unsigned int skipPages = offset >> PAGE_SHIFT;
-	for(Page *page = mPages.head(); page != 0; page = mPages.next(page)) {
-		// Skip pages until we get to the one containing the beginning of the mapping
-		if(skipPages > 0) {
-			skipPages--;
+	int start = offset >> PAGE_SHIFT;
+	int end = start + (size >> PAGE_SHIFT);
+	if(end > mNumPages) {
+		end = mNumPages;
+	}
+
+	for(int i=start; i<end;) {
+		// Map each page that has been allocated so far into the table.  The
+		// rest will be filled in as they are faulted on.  Pages which are shared
+		// with other areas are mapped read-only, so that writes can be caught.
+		if(!mPages[i]) {
+			i++;
+			v += PAGE_SIZE;
+			continue;
+		}
+
+		PageTable::Permission permission = (mPages[i]->refCount() > 1) ? PageTable::PermissionRO : PageTable::PermissionRW;
+
+		// Gather up a run of physically contiguous pages with the same
+		// permission, so that the table can map it with sections and large
+		// pages where the alignment allows
+		int run = 1;
+		while(i + run < end && mPages[i + run] == mPages[i] + run &&
+		      ((mPages[i + run]->refCount() > 1) ? PageTable::PermissionRO : PageTable::PermissionRW) == permission) {
+			run++;
+		}
+
+		table->mapRange((void*)v, mPages[i]->paddr(), run << PAGE_SHIFT, permission);
+		i += run;
+		v += run << PAGE_SHIFT;
+	}
+}
+
+bool MemAreaPages::fault(PageTable *table, void *vaddr, unsigned int offset, unsigned int mapStart, unsigned int mapEnd)
+{
+	int idx = offset >> PAGE_SHIFT;
+	if(idx >= mNumPages) {
+		return false;
+	}
+
+	Page *page = mPages[idx];
+
+	if(!page) {
+		// Areas which asked for large pages fill in a whole section or large
+		// page around the faulting page at once, so that it takes only a
+		// single TLB entry
+		if(mLargePages &&
+		   (faultBlock(table, vaddr, idx, mapStart, mapEnd, SECTION_ORDER) ||
+		    faultBlock(table, vaddr, idx, mapStart, mapEnd, LARGE_PAGE_ORDER))) {
+			return true;
+		}
+
+		// A page which has never been written reads as zeroes, so the first
+		// fault maps the shared zero page.  If the access was a write, it
+		// faults again on the read-only mapping, and only then is memory
+		// allocated.
+		if(table->translateVAddr(vaddr) != zeroPage()->paddr()) {
+			table->mapPage(vaddr, zeroPage()->paddr(), PageTable::PermissionRO);
+			return true;
+		}
+
+		// Allocate the page on first touch
+		page = Page::allocZeroed();
+		if(!page) {
+			return false;
+		}
+		mPages[idx] = page;
+	} else if(page->refCount() > 1) {
+		if(table->translateVAddr(vaddr) != page->paddr()) {
+			// Shared page not yet mapped into this table.  Map it read-only, and
+			// let a subsequent write fault make the copy.
+			table->mapPage(vaddr, page->paddr(), PageTable::PermissionRO);
+			return true;
+		}
+
+		// Write to a shared page--give this area its own copy
+		Page *copy = Page::alloc();
+		if(!copy) {
+			return false;
+		}
+		::memcpy(copy->vaddr(), page->vaddr(), PAGE_SIZE);
+
+		// Both pages were accessed through their kernel addresses, so make sure
+		// nothing is left behind in the cache under those addresses
+		CleanInvalidateDCacheRange(copy->vaddr(), PAGE_SIZE);
+		CleanInvalidateDCacheRange(page->vaddr(), PAGE_SIZE);
+		mPages[idx] = copy;
+		page->free();
+		page = copy;
+	}
+
+	// This area is now the sole owner of the page, so it can be mapped
+	// writable.  This also upgrades pages left read-only by an earlier share.
+	table->mapPage(vaddr, page->paddr(), PageTable::PermissionRW);
+
+	// The page may have been the last one missing from a block
+	promote(table, vaddr, idx, mapStart, mapEnd);
+	return true;
+}
+
+// Find the first page index of the naturally aligned block of the given order
+// around a faulting page.  Returns -1 if the block does not lie entirely
+// within the area and the faulting mapping.
+int MemAreaPages::blockStart(void *vaddr, int idx, unsigned int mapStart, unsigned int mapEnd, int order)
+{
+	unsigned blockVAddr = (unsigned)vaddr & ~((PAGE_SIZE << order) - 1);
+	int first = idx - (((unsigned)vaddr - blockVAddr) >> PAGE_SHIFT);
+	int num = 1 << order;
+
+	if(first < 0 || first + num > mNumPages ||
+	   (unsigned)first << PAGE_SHIFT < mapStart || (unsigned)(first + num) << PAGE_SHIFT > mapEnd) {
+		return -1;
+	}
+
+	return first;
+}
+
+// Allocate and map a block of zero-filled pages, naturally aligned in both
+// the virtual and physical address spaces, around a faulting page.  This is
+// only done if none of the block's pages have been allocated yet.
+bool MemAreaPages::faultBlock(PageTable *table, void *vaddr, int idx, unsigned int mapStart, unsigned int mapEnd, int order)
+{
+	int first = blockStart(vaddr, idx, mapStart, mapEnd, order);
+	if(first < 0) {
+		return false;
+	}
+
+	unsigned blockSize = PAGE_SIZE << order;
+	unsigned blockVAddr = (unsigned)vaddr & ~(blockSize - 1);
+	int num = 1 << order;
+
+	for(int i=first; i<first + num; i++) {
+		if(mPages[i]) {
+			return false;
+		}
+	}
+
+	Page *block = Page::allocBlockZeroed(order);
+	if(!block) {
+		return false;
+	}
+
+	for(int i=0; i<num; i++) {
+		mPages[first + i] = &block[i];
+	}
+	table->mapRange((void*)blockVAddr, block->paddr(), blockSize, PageTable::PermissionRW);
+
+	return true;
+}
+
+// Map the block around a page as a single section or large page, if all of
+// its pages are present, physically contiguous and aligned, and owned by
+// this area alone
+void MemAreaPages::promote(PageTable *table, void *vaddr, int idx, unsigned int mapStart, unsigned int mapEnd)
+{
+	static const int orders[] = { SECTION_ORDER, LARGE_PAGE_ORDER };
+
+	for(unsigned int o=0; o<sizeof(orders) / sizeof(orders[0]); o++) {
+		int first = blockStart(vaddr, idx, mapStart, mapEnd, orders[o]);
+		if(first < 0) {
 			continue;
 		}
 
-		// Map each page into the table
-		table->mapPage((void*)v, page->paddr(), PageTable::PermissionRW);
-		v += PAGE_SIZE;
+		unsigned blockSize = PAGE_SIZE << orders[o];
+		Page *base = mPages[first];
+		if(!base || (base->paddr() & (blockSize - 1)) != 0) {
+			continue;
+		}
+
+		bool complete = true;
+		for(int i=0; i<(1 << orders[o]); i++) {
+			if(mPages[first + i] != base + i || base[i].refCount() != 1) {
+				complete = false;
+				break;
+			}
+		}
+
+		if(complete) {
+			table->mapRange((void*)((unsigned)vaddr & ~(blockSize - 1)), base->paddr(), blockSize, PageTable::PermissionRW);
+			return;
+		}
 	}
 }
 
-void MemAreaPages::doExpand(int newSize)
+MemArea *MemAreaPages::clone()
 {
-	if(newSize <= size()) {
-		return;
+	return shareInto(new MemAreaPages(size(), mLargePages));
+}
+
+/*!
+ * \brief Share every page allocated so far with a new area, as part of a clone
+ *
+ * If the new area ran out of memory for its page array, it is left empty.
+ * \param area New area
+ * \return The new area
+ */
+MemArea *MemAreaPages::shareInto(MemAreaPages *area)
+{
+	for(int i=0; i<mNumPages && i<area->mNumPages; i++) {
+		if(mPages[i]) {
+			area->setPage(i, mPages[i]);
+		}
 	}
 
-	unsigned int newPages = (newSize - size()) >> PAGE_SHIFT;
+	return area;
+}
+
+void MemAreaPages::discard(unsigned int offset, unsigned int size)
+{
+	int start = offset >> PAGE_SHIFT;
+	int end = start + (size >> PAGE_SHIFT);
+	if(end > mNumPages) {
+		end = mNumPages;
+	}
 
-	for(int i=0; i<newPages; i++) {
-		Page *page = Page::alloc();
-		mPages.addTail(page);
+	// Drop the pages, so that they are faulted back in zero-filled if the
+	// range is ever mapped again
+	for(int i=start; i<end; i++) {
+		setPage(i, 0);
 	}
 }
 
+/*!
+ * \brief Allocate a zero-filled page for an index which has none yet, for
+ *        areas which skip the shared zero page
+ * \param idx Page index
+ * \return True if the index now has a page, false if memory ran out
+ */
+bool MemAreaPages::allocPage(int idx)
+{
+	if(idx >= mNumPages || mPages[idx]) {
+		return true;
+	}
+
+	Page *page = Page::allocZeroed();
+	if(!page) {
+		return false;
+	}
+
+	mPages[idx] = page;
+	return true;
+}
+
+/*!
+ * \brief Replace the page at a given index, taking a reference on the new page
+ * \param idx Page index
+ * \param page New page
+ */
+void MemAreaPages::setPage(int idx, Page *page)
+{
+	if(page) {
+		page->ref();
+	}
+
+	if(mPages[idx]) {
+		mPages[idx]->free();
+	}
+
+	mPages[idx] = page;
+}
+
+bool MemAreaPages::doExpand(int newSize)
+{
+	int newNumPages = newSize >> PAGE_SHIFT;
+	if(newNumPages <= mNumPages) {
+		return true;
+	}
+
+	// Only make room for the new pages here.  The pages themselves are
+	// allocated zero-filled as they are faulted on.
+	if(!growPageArray(newNumPages)) {
+		return false;
+	}
+
+	mNumPages = newNumPages;
+	return true;
+}
+
+// Make room in the page array for at least the given number of entries.
+// Small areas keep the array inside the area itself, so that they cost no
+// more than a slab entry.  Returns false if memory ran out, in which case
+// the existing array is left as it was.
+bool MemAreaPages::growPageArray(int numPages)
+{
+	if(numPages <= INLINE_PAGES) {
+		return true;
+	}
+
+	int order = 0;
+	while((PAGE_SIZE << order) / sizeof(Page*) < numPages) {
+		order++;
+	}
+
+	if(mPageArrayBlock && order <= mPageArrayOrder) {
+		return true;
+	}
+
+	// Allocate a larger array and move the existing entries over into it
+	Page *block = Page::allocBlockZeroed(order);
+	if(!block) {
+		return false;
+	}
+
+	Page **pages = (Page**)block->vaddr();
+	::memcpy(pages, mPages, mNumPages * sizeof(Page*));
+
+	if(mPageArrayBlock) {
+		for(int i=0; i<(1 << mPageArrayOrder); i++) {
+			mPageArrayBlock[i].free();
+		}
+	}
+
+	mPages = pages;
+	mPageArrayBlock = block;
+	mPageArrayOrder = order;
+	return true;
+}
+
+/*!
+ * \brief Constructor
+ * \param size Size of stack, not including the guard page
+ */
+MemAreaStack::MemAreaStack(int size)
+ : MemAreaPages(size + PAGE_SIZE)
+{
+}
+
+bool MemAreaStack::fault(PageTable *table, void *vaddr, unsigned int offset, unsigned int mapStart, unsigned int mapEnd)
+{
+	// The guard page is never backed
+	if(offset < PAGE_SIZE) {
+		return false;
+	}
+
+	// Stack pages are written as soon as they are reached, so skip the
+	// shared zero page and allocate straight away
+	if(!allocPage(offset >> PAGE_SHIFT)) {
+		return false;
+	}
+
+	// Narrow the mapping down to the faulting page, so that no larger block
+	// ever fits around it
+	return MemAreaPages::fault(table, vaddr, offset, offset, offset + PAGE_SIZE);
+}
+
+MemArea *MemAreaStack::clone()
+{
+	return shareInto(new MemAreaStack(size() - PAGE_SIZE));
+}
+
+/*!
+ * \brief Constructor
+ * \param size Size of area
+ */
+MemAreaShared::MemAreaShared(int size)
+ : MemAreaPages(size)
+{
+}
+
+bool MemAreaShared::fault(PageTable *table, void *vaddr, unsigned int offset, unsigned int mapStart, unsigned int mapEnd)
+{
+	// A zero page mapped here would go stale as soon as another process
+	// wrote to the area, so allocate the real page on first touch
+	if(!allocPage(offset >> PAGE_SHIFT)) {
+		return false;
+	}
+
+	return MemAreaPages::fault(table, vaddr, offset, mapStart, mapEnd);
+}
+
+MemArea *MemAreaShared::clone()
+{
+	// Writes through either address space must be seen by the other, so
+	// the clone shares the area itself rather than copying its pages
+	return this;
+}
+
 /*!
  * \brief Constructor
  * \param size Size of area
@@ -106,9 +553,7 @@ MemAreaPhys::MemAreaPhys(int size, PAddr paddr)
 
 void MemAreaPhys::map(PageTable *table, void *vaddr, unsigned int offset, unsigned int size)
 {
-	unsigned v = (unsigned)vaddr;
-	for(PAddr paddr = mPAddr; paddr < mPAddr + size; paddr += PAGE_SIZE, v += PAGE_SIZE) {
-		// Map each page of physical address space into the page table
-		table->mapPage((void*)v, paddr, PageTable::PermissionRW);
-	}
+	// The area is physically contiguous, so the table can use sections and
+	// large pages wherever the alignment allows
+	table->mapRange(vaddr, mPAddr + offset, size, PageTable::PermissionRW, PageTable::CacheabilityUncached);
 }
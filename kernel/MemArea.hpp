@@ -9,6 +9,7 @@
 #include <stddef.h>
 
 class PageTable;
+class MemAreaPages;
 
 /*!
  * \brief Represents a region of physical memory.  Abstract base class.
@@ -22,7 +23,7 @@ public:
 	 * \return Size
 	 */
 	int size() { return mSize; }
-	void expand(int newSize);
+	bool expand(int newSize);
 
 	/*!
 	 * \brief Map this area into a page table
@@ -32,9 +33,18 @@ public:
 	 * \param size Size of mapping
 	 */
 	virtual void map(PageTable *table, void *vaddr, unsigned int offset, unsigned int size) = 0;
+	virtual bool fault(PageTable *table, void *vaddr, unsigned int offset, unsigned int mapStart, unsigned int mapEnd);
+	virtual MemArea *clone();
+	virtual void discard(unsigned int offset, unsigned int size);
+
+	/*!
+	 * \brief Get this area as a set of allocated pages
+	 * \return Area, or 0 if it is not backed by allocated pages
+	 */
+	virtual MemAreaPages *asPages() { return 0; }
 
 protected:
-	virtual void doExpand(int size);
+	virtual bool doExpand(int size);
 	virtual void free() = 0;
 	virtual void onLastRef();
 
@@ -44,34 +54,137 @@ private:
 
 /*!
  * \brief A memory area backed by a set of allocated pages
+ *
+ * The area holds one reference on each of its pages, so a page may be
+ * shared with other areas.  Pages are allocated on demand, the first
+ * time they are touched.  Shared pages are mapped read-only, and copied
+ * the first time they are written.
+ *
+ * Once every page of an aligned 64KB or 1MB block has been allocated, and
+ * the pages happen to be physically contiguous, the block is mapped as a
+ * single large page or section.  Areas created with largePages set skip the
+ * wait, and allocate a whole block the first time any part of it is touched.
  */
 class MemAreaPages : public MemArea {
 public:
-	MemAreaPages(int size);
+	MemAreaPages(int size, bool largePages = false);
 	~MemAreaPages();
 
 	virtual void map(PageTable *table, void *vaddr, unsigned int offset, unsigned int size);
+	virtual bool fault(PageTable *table, void *vaddr, unsigned int offset, unsigned int mapStart, unsigned int mapEnd);
+	virtual MemArea *clone();
+	virtual void discard(unsigned int offset, unsigned int size);
+	virtual MemAreaPages *asPages() { return this; }
+
+	/*!
+	 * \brief Determine whether pages of this area may be merged with identical
+	 *        pages elsewhere
+	 * \return True if mergeable
+	 */
+	virtual bool mergeable() { return true; }
 
 	/*!
-	 * \brief Get page list
-	 * \return Pages
+	 * \brief Number of pages in the area
+	 * \return Number of pages
 	 */
-	List<Page>& pages() { return mPages; }
+	int numPages() { return mNumPages; }
+
+	/*!
+	 * \brief Get the page backing a given page index within the area
+	 * \param idx Page index
+	 * \return Page, or 0 if it has not yet been allocated
+	 */
+	Page *page(int idx) { return mPages[idx]; }
+	void setPage(int idx, Page *page);
 
 	//! Allocator
 	void *operator new(size_t size) { return sSlab.allocate(); }
 	void operator delete(void *p) { sSlab.free((MemAreaPages*)p); }
 
 protected:
-	virtual void doExpand(int newSize);
+	virtual bool doExpand(int newSize);
 	virtual void free() { delete this; }
+	MemArea *shareInto(MemAreaPages *area);
+	bool allocPage(int idx);
 
 private:
-	List<Page> mPages; //!< Page list
+	static const int INLINE_PAGES = 16; //!< Number of pages which fit in the area's own page array
+
+	bool growPageArray(int numPages);
+	int blockStart(void *vaddr, int idx, unsigned int mapStart, unsigned int mapEnd, int order);
+	bool faultBlock(PageTable *table, void *vaddr, int idx, unsigned int mapStart, unsigned int mapEnd, int order);
+	void promote(PageTable *table, void *vaddr, int idx, unsigned int mapStart, unsigned int mapEnd);
+
+	Page **mPages; //!< Array of pages backing the area
+	int mNumPages; //!< Number of pages in the area
+	Page *mInlinePages[INLINE_PAGES]; //!< Page array for small areas
+	Page *mPageArrayBlock; //!< Block of pages holding the page array, or 0 if it is held inline
+	int mPageArrayOrder; //!< Order of the page array block
+	bool mLargePages; //!< True if whole blocks are allocated on first touch
 
 	static Slab<MemAreaPages> sSlab;
 };
 
+/*!
+ * \brief A memory area backing a user stack
+ *
+ * Pages are faulted in one at a time, never as whole blocks, so the memory
+ * used by the stack stays in proportion to the depth it actually reaches.
+ * The area begins with an extra guard page, which is never backed, so that
+ * running off the end of the stack faults, and nothing else can be mapped
+ * directly beneath it.
+ */
+class MemAreaStack : public MemAreaPages {
+public:
+	MemAreaStack(int size);
+
+	virtual bool fault(PageTable *table, void *vaddr, unsigned int offset, unsigned int mapStart, unsigned int mapEnd);
+	virtual MemArea *clone();
+
+	//! Allocator
+	void *operator new(size_t size) { return sSlab.allocate(); }
+	void operator delete(void *p) { sSlab.free((MemAreaStack*)p); }
+
+protected:
+	virtual void free() { delete this; }
+
+private:
+	static Slab<MemAreaStack> sSlab;
+};
+
+/*!
+ * \brief A memory area shared between processes through a shared memory object
+ *
+ * Every process which maps the area sees the same pages, and a cloned
+ * address space keeps sharing them rather than taking copies.  Pages are
+ * never stood in for by the shared zero page, since a write through one
+ * mapping must be seen through all of the others.
+ */
+class MemAreaShared : public MemAreaPages {
+public:
+	MemAreaShared(int size);
+
+	virtual bool fault(PageTable *table, void *vaddr, unsigned int offset, unsigned int mapStart, unsigned int mapEnd);
+	virtual MemArea *clone();
+
+	/*!
+	 * \brief Shared areas are never merged, since a copy-on-write fault through
+	 *        one mapping would leave the others behind on the old page
+	 * \return False
+	 */
+	virtual bool mergeable() { return false; }
+
+	//! Allocator
+	void *operator new(size_t size) { return sSlab.allocate(); }
+	void operator delete(void *p) { sSlab.free((MemAreaShared*)p); }
+
+protected:
+	virtual void free() { delete this; }
+
+private:
+	static Slab<MemAreaShared> sSlab;
+};
+
 /*!
  * \brief A memory area backed by a range of physical addresses, used for memory-mapped I/O
  */
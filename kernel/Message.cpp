@@ -54,14 +54,26 @@ static int readMessage(Process *destProcess, void *dest, Process *srcProcess, co
 			}
 
 			// Get the kernel addresses for the object slot in both the source and destination buffers
-			int *s = (int*)PADDR_TO_VADDR(srcProcess->addressSpace()->pageTable()->translateVAddr((char*)segment.buffer + objOffset - srcOffset));
-			int *d = (int*)PADDR_TO_VADDR(destProcess->addressSpace()->pageTable()->translateVAddr((char*)dest + objOffset - offset));
+			void *srcSlot = (char*)segment.buffer + objOffset - srcOffset;
+			void *destSlot = (char*)dest + objOffset - offset;
+			PAddr srcPAddr = srcProcess->addressSpace()->translate(srcSlot, false);
+			PAddr destPAddr = destProcess->addressSpace()->translate(destSlot, true);
+			if(srcPAddr == PADDR_INVALID || destPAddr == PADDR_INVALID) {
+				continue;
+			}
+
+			int *s = (int*)PADDR_TO_VADDR(srcPAddr);
+			int *d = (int*)PADDR_TO_VADDR(destPAddr);
 
 			// Get the object id in the source buffer
+			srcProcess->addressSpace()->beginKernelAccess(srcSlot, sizeof(int));
 			int obj = *s;
+			AddressSpace::endKernelAccess(s, sizeof(int));
 
 			// Duplicate the object into the destination process
+			destProcess->addressSpace()->beginKernelAccess(destSlot, sizeof(int));
 			*d = destProcess->dupObjectRef(srcProcess, obj);
+			AddressSpace::endKernelAccess(d, sizeof(int));
 		}
 
 		// Record how much data was copied from this source segment
@@ -177,8 +189,9 @@ int MessageEvent::read(struct MessageHeader *header)
 	event.type = mType;
 	event.value = mValue;
 
-	// Copy data into the header's segment
-	memcpy(header->segments[0].buffer, &event, sizeof(event));
+	// Copy data into the header's segment.  Read-only pages, such as the
+	// shared zero page, do not stop kernel writes, so go by physical address.
+	AddressSpace::memcpy(Sched::current()->process()->addressSpace(), header->segments[0].buffer, 0, &event, sizeof(event));
 
 	return sizeof(event);
 }
@@ -32,6 +32,12 @@ public:
 
 	bool active() { return mChannel->active(); }
 
+	/*!
+	 * \brief Channel on which the object's messages are received
+	 * \return Channel
+	 */
+	Channel *channel() { return mChannel.ptr(); }
+
 	virtual void onLastRef();
 
 	//! Allocator
@@ -1,7 +1,12 @@
 #include "Page.hpp"
 
+#include "AsmFuncs.hpp"
+
 #include <string.h>
 
+//! Number of pre-zeroed pages to keep on hand
+#define ZEROED_POOL_SIZE 256
+
 /*!
  * \brief Page list--one entry per page of physical memory
  *
@@ -11,13 +16,42 @@
  */
 Page Page::sPages[N_PAGES];
 
+/*!
+ * \brief Buddy allocator free lists, one per order
+ *
+ * List n contains the first page of each free, naturally-aligned block
+ * of 2^n pages.
+ */
+List<Page> Page::sFreeLists[N_PAGE_ORDERS];
+
+//! Pool of allocated pages that have already been zero-filled
+List<Page> Page::sZeroedPages;
+
+//! Number of pages in the zeroed pool
+int Page::sNumZeroedPages;
+
 /*!
  * \brief Initialize the page list
  */
 void Page::init()
 {
-	// Just zero everything out
+	// Zero everything out
 	memset(sPages, 0, N_PAGES * sizeof(Page));
+	for(int i=0; i<N_PAGE_ORDERS; i++) {
+		sFreeLists[i].init();
+	}
+	sZeroedPages.init();
+	sNumZeroedPages = 0;
+
+	// Mark as in use all pages used by the kernel itself
+	int kernelEnd = fromVAddr(__KernelEnd)->number();
+	for(int i=0; i<=kernelEnd; i++) {
+		sPages[i].mFlags = FlagsInUse;
+		sPages[i].mRefCount = 1;
+	}
+
+	// Hand the remainder of RAM to the allocator
+	freeRange(fromNumber(kernelEnd + 1), N_PAGES - kernelEnd - 1);
 }
 
 /*!
@@ -26,19 +60,93 @@ void Page::init()
  */
 Page *Page::alloc()
 {
-	// World's stupidest page allocator--just scan linearly through
-	// the list looking for a free page.
-	for(int i=0; i<N_PAGES; i++) {
-		Page *page = fromNumber(i);
-
-		if(page->flags() == FlagsFree) {
-			// Mark as in use, and return
-			page->setFlags(FlagsInUse);
-			return page;
+	Page *page = allocBlock(0);
+
+	// If the allocator is exhausted, fall back on the zeroed pool
+	if(!page && sNumZeroedPages > 0) {
+		page = sZeroedPages.removeHead();
+		sNumZeroedPages--;
+	}
+
+	return page;
+}
+
+/*!
+ * \brief Allocate a page whose contents are all zero
+ *
+ * Pages are taken from the pre-zeroed pool when possible, so that
+ * the cost of clearing them is paid while the system is idle.
+ * \return Page pointer
+ */
+Page *Page::allocZeroed()
+{
+	if(sNumZeroedPages > 0) {
+		sNumZeroedPages--;
+		return sZeroedPages.removeHead();
+	}
+
+	Page *page = allocBlock(0);
+	if(page) {
+		zero(page);
+	}
+
+	return page;
+}
+
+/*!
+ * \brief Allocate a naturally-aligned block of pages
+ * \param order Power of two of the number of pages to allocate
+ * \return Pointer to the first allocated page
+ */
+Page *Page::allocBlock(int order)
+{
+	// Find the smallest free block that is large enough
+	int n;
+	for(n = order; n < N_PAGE_ORDERS; n++) {
+		if(!sFreeLists[n].empty()) {
+			break;
+		}
+	}
+
+	if(n == N_PAGE_ORDERS) {
+		return 0;
+	}
+
+	Page *page = sFreeLists[n].removeHead();
+
+	// Split the block in half until it is the requested size, returning
+	// the upper half to the free lists each time
+	while(n > order) {
+		n--;
+		Page *buddy = page + (1 << n);
+		buddy->mOrder = n;
+		sFreeLists[n].addHead(buddy);
+	}
+
+	// Mark every page in the block as in use, with a single reference
+	for(int i=0; i<(1 << order); i++) {
+		page[i].mFlags = FlagsInUse;
+		page[i].mRefCount = 1;
+	}
+
+	return page;
+}
+
+/*!
+ * \brief Allocate a naturally-aligned block of zero-filled pages
+ * \param order Power of two of the number of pages to allocate
+ * \return Pointer to the first allocated page
+ */
+Page *Page::allocBlockZeroed(int order)
+{
+	Page *page = allocBlock(order);
+	if(page) {
+		for(int i=0; i<(1 << order); i++) {
+			zero(&page[i]);
 		}
 	}
 
-	return 0;
+	return page;
 }
 
 /*!
@@ -50,10 +158,63 @@ List<Page> Page::allocMulti(int num)
 {
 	List<Page> list;
 
-	// Even stupider than the single page allocator--scan
-	// linearly through the page list multiple times!
-	for(int n=0; n < num; n++) {
-		Page *page = alloc();
+	// Carve the request into the largest blocks the allocator can supply,
+	// so that the resulting list is made up of physically contiguous runs
+	int order = N_PAGE_ORDERS - 1;
+	while(num > 0) {
+		while((1 << order) > num) {
+			order--;
+		}
+
+		Page *pages = allocBlock(order);
+		if(!pages) {
+			if(order == 0) {
+				// Out of memory--give back what was allocated so far
+				freeList(list);
+				list.init();
+				break;
+			}
+
+			// Nothing this large is free, so try smaller blocks from now on
+			order--;
+			continue;
+		}
+
+		for(int i=0; i<(1 << order); i++) {
+			list.addTail(pages + i);
+		}
+		num -= 1 << order;
+	}
+
+	return list;
+}
+
+/*!
+ * \brief Allocate multiple zero-filled pages
+ * \param num Number of pages to allocate
+ * \return List of pages
+ */
+List<Page> Page::allocMultiZeroed(int num)
+{
+	List<Page> list;
+
+	// Drain the zeroed pool first
+	while(num > 0 && sNumZeroedPages > 0) {
+		list.addTail(sZeroedPages.removeHead());
+		sNumZeroedPages--;
+		num--;
+	}
+
+	// Allocate the remainder in bulk and clear it by hand
+	List<Page> rest = allocMulti(num);
+	if(num > 0 && rest.empty()) {
+		freeList(list);
+		list.init();
+		return list;
+	}
+
+	while(Page *page = rest.removeHead()) {
+		zero(page);
 		list.addTail(page);
 	}
 
@@ -68,39 +229,37 @@ List<Page> Page::allocMulti(int num)
  */
 Page *Page::allocContig(int align, int num)
 {
-	// Another stupid page allocator--scan stepwise
-	// through the page list, looking for a set of
-	// contiguous free pages
-	for(int i=0; i<N_PAGES; i += align) {
-		int j;
-		for(j=0; j<num; j++) {
-			Page *page = fromNumber(i + j);
-
-			if(page->flags() == FlagsInUse) {
-				break;
-			}
-		}
+	// Buddy blocks are naturally aligned, so pick an order large enough
+	// to satisfy both the size and alignment requirements
+	int order = 0;
+	while((1 << order) < num || (1 << order) < align) {
+		order++;
+	}
 
-		// If enough pages were found, mark as in use and return
-		if(j == num) {
-			for(j=0; j<num; j++) {
-				Page *page = fromNumber(i + j);
+	Page *pages = allocBlock(order);
+	if(!pages) {
+		return 0;
+	}
 
-				page->setFlags(FlagsInUse);
-			}
-			return fromNumber(i);
-		}
+	// Give back any pages beyond what was requested
+	if(num < (1 << order)) {
+		freeRange(pages + num, (1 << order) - num);
 	}
 
-	return 0;
+	return pages;
 }
 
 /*!
- * \brief Free page
+ * \brief Drop a reference to the page, freeing it once the last one is gone
  */
 void Page::free()
 {
-	mFlags = FlagsFree;
+	mRefCount--;
+	if(mRefCount > 0) {
+		return;
+	}
+
+	freeBlock(this, 0);
 }
 
 /*!
@@ -117,3 +276,85 @@ void Page::freeList(List<Page> list)
 		page->free();
 	}
 }
+
+/*!
+ * \brief Zero one free page and add it to the zeroed pool
+ *
+ * Called from the scheduler's idle loop.  Only a single page is cleared
+ * per call, so that pending interrupts are not held off for long.
+ * \return True if a page was zeroed, false if there was nothing to do
+ */
+bool Page::refillZeroed()
+{
+	if(sNumZeroedPages >= ZEROED_POOL_SIZE) {
+		return false;
+	}
+
+	Page *page = allocBlock(0);
+	if(!page) {
+		return false;
+	}
+
+	zero(page);
+	sZeroedPages.addTail(page);
+	sNumZeroedPages++;
+
+	return true;
+}
+
+// Zero-fill a page.  The page may end up mapped elsewhere, or read by the
+// MMU, so the zeroes are written out of the cache to memory.
+void Page::zero(Page *page)
+{
+	memset(page->vaddr(), 0, PAGE_SIZE);
+	CleanInvalidateDCacheRange(page->vaddr(), PAGE_SIZE);
+}
+
+// Return a naturally-aligned block to the free lists, coalescing it with
+// its buddy for as long as the buddy is also free
+void Page::freeBlock(Page *page, int order)
+{
+	for(int i=0; i<(1 << order); i++) {
+		page[i].mFlags = FlagsFree;
+		page[i].mOrder = -1;
+	}
+
+	int n = page->number();
+	while(order < N_PAGE_ORDERS - 1) {
+		Page *buddy = fromNumber(n ^ (1 << order));
+
+		// Only merge with a buddy that heads a free block of the same size
+		if(buddy->mFlags != FlagsFree || buddy->mOrder != order) {
+			break;
+		}
+
+		sFreeLists[order].remove(buddy);
+		buddy->mOrder = -1;
+		n &= ~(1 << order);
+		order++;
+	}
+
+	Page *head = fromNumber(n);
+	head->mOrder = order;
+	sFreeLists[order].addHead(head);
+}
+
+// Free an arbitrary run of pages, breaking it into the largest
+// naturally-aligned blocks possible
+void Page::freeRange(Page *page, int num)
+{
+	int n = page->number();
+	int end = n + num;
+
+	while(n < end) {
+		int order = 0;
+		while(order + 1 < N_PAGE_ORDERS &&
+		      (n & ((1 << (order + 1)) - 1)) == 0 &&
+		      n + (1 << (order + 1)) <= end) {
+			order++;
+		}
+
+		freeBlock(fromNumber(n), order);
+		n += 1 << order;
+	}
+}
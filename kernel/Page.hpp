@@ -21,24 +21,46 @@
 //! Number of RAM pages
 #define N_PAGES (RAM_SIZE >> PAGE_SHIFT)
 
+//! Number of buddy allocator orders--blocks range from one page up to all of RAM
+#define N_PAGE_ORDERS 16
+
 //! Type for all physical addresses
 typedef unsigned int PAddr;
 
+//! Marker for a virtual address with no physical address behind it
+#define PADDR_INVALID 0xffffffff
+
 //! Convert physical address to virtual address
-#define PADDR_TO_VADDR(paddr) ((char*)(paddr) + KERNEL_START)
+#define PADDR_TO_VADDR(paddr) ((char*)(paddr) - RAM_START + KERNEL_START)
 
 //! Convert virtual address to physical address
-#define VADDR_TO_PADDR(vaddr) ((PAddr)(vaddr) - KERNEL_START)
+#define VADDR_TO_PADDR(vaddr) ((PAddr)(vaddr) - KERNEL_START + RAM_START)
+
+//! Determine whether a physical address lies in RAM
+#define PADDR_IS_RAM(paddr) ((PAddr)(paddr) - RAM_START < RAM_SIZE)
 
 #define PAGE_SIZE_ROUND_UP(size) ((size + PAGE_SIZE - 1) & PAGE_MASK)
 #define PAGE_ADDR_ROUND_DOWN(addr) ((unsigned)addr & PAGE_MASK)
 
 // These symbols are populated by the linker script, and point to
-// the beginning and end of the kernel's in-memory image
+// the beginning and end of the kernel's in-memory image, and the
+// physical address at which RAM starts
 extern char __KernelStart[];
 extern char __KernelEnd[];
+extern char __RamStart[];
 
 #define KERNEL_START (unsigned int)__KernelStart
+#define RAM_START (PAddr)__RamStart
+
+#ifdef ARCH_ARMV7
+//! End of the user portion of the address space.  User page tables are
+//! loaded into TTBR0, and only cover the bottom 1GB.  The kernel page
+//! table, in TTBR1, covers the rest.
+#define USER_END 0x40000000
+#else
+//! End of the user portion of the address space
+#define USER_END KERNEL_START
+#endif
 
 /*!
  * \brief Represents a page of physical RAM, as well as page allocator
@@ -64,6 +86,17 @@ public:
 	 */
 	void setFlags(Flags flags) { mFlags = flags; }
 
+	/*!
+	 * \brief Number of references held on an in-use page
+	 * \return Reference count
+	 */
+	int refCount() { return mRefCount; }
+
+	/*!
+	 * \brief Add a reference to an in-use page
+	 */
+	void ref() { mRefCount++; }
+
 	/*!
 	 * \brief Return page number
 	 * \return Page number
@@ -74,7 +107,7 @@ public:
 	 * \brief Physical address of page
 	 * \return Physical address
 	 */
-	PAddr paddr() { return (PAddr)(number() << PAGE_SHIFT); }
+	PAddr paddr() { return RAM_START + (PAddr)(number() << PAGE_SHIFT); }
 
 	/*!
 	 * \brief Virtual address of page
@@ -84,10 +117,16 @@ public:
 	void free();
 
 	static Page *allocContig(int align, int num);
+	static Page *allocBlock(int order);
+	static Page *allocBlockZeroed(int order);
 	static List<Page> allocMulti(int num);
+	static List<Page> allocMultiZeroed(int num);
 	static Page *alloc();
+	static Page *allocZeroed();
 	static void freeList(List<Page> list);
 
+	static bool refillZeroed();
+
 	/*!
 	 * \brief Retrieve a page pointer from its number
 	 * \param n Page number
@@ -100,7 +139,7 @@ public:
 	 * \param paddr Physical address
 	 * \return Page pointer
 	 */
-	static Page *fromPAddr(PAddr paddr) { return fromNumber(paddr >> PAGE_SHIFT); }
+	static Page *fromPAddr(PAddr paddr) { return fromNumber((paddr - RAM_START) >> PAGE_SHIFT); }
 
 	/*!
 	 * \brief Retrieve a page pointer from its virtual address
@@ -110,9 +149,20 @@ public:
 	static Page *fromVAddr(void *vaddr) { return fromPAddr(VADDR_TO_PADDR(vaddr)); }
 
 private:
+	static void freeBlock(Page *page, int order);
+	static void freeRange(Page *page, int num);
+	static void zero(Page *page);
+
 	Flags mFlags; //!< Flags
+	union {
+		int mOrder; //!< Free pages: order of the block headed by this page, or -1 if not a block head
+		int mRefCount; //!< In-use pages: number of references held on the page
+	};
 
 	static Page sPages[N_PAGES];
+	static List<Page> sFreeLists[N_PAGE_ORDERS];
+	static List<Page> sZeroedPages;
+	static int sNumZeroedPages;
 };
 
 #endif
@@ -1,132 +1,565 @@
 #include "PageTable.hpp"
 
 #include "Pte.hpp"
+#include "AsmFuncs.hpp"
+#include "AddressSpace.hpp"
 
 #include <string.h>
 
 //! Slab allocator for page tables
 struct Slab<PageTable> PageTable::sSlab;
 
+//! Number of prebuilt tables to keep on hand
+#define SPARE_TABLES_SIZE 4
+
+#ifdef ARCH_ARMV7
+//! Pages in a user top-level table.  These only cover the user portion of
+//! the address space; the MMU finds the kernel portion in the kernel table.
+#define USER_TABLE_PAGES 1
+#else
+//! Pages in a user top-level table
+#define USER_TABLE_PAGES 4
+#endif
+
+//! Active page table
+PageTable *PageTable::sActive;
+
+//! Kernel page table, the master copy of the kernel portion of every table
+PageTable *PageTable::sKernel;
+
+//! All page tables in existence
+List<PageTable> PageTable::sTables;
+
+//! Prebuilt tables, ready to be handed to new page tables
+List<Page> PageTable::sSpareTables;
+
+//! Number of prebuilt tables
+int PageTable::sNumSpareTables;
+
+//! Marker for an unused translation cache entry.  This is never a page address.
+#define TRANSLATION_CACHE_EMPTY 0xffffffff
+
+//! Marker identifying a free second-level table.  This is never a valid entry.
+#define L2_TABLE_FREE 0xffffffff
+
+//! Free second-level tables, shared by all page tables
+List<PageTable::FreeL2Table> PageTable::sFreeL2Tables;
+
+//! Current ASID generation.  This starts above 0, so that tables which have never been given an ASID are out of date.
+unsigned PageTable::sASIDGeneration = ASID_MASK + 1;
+
+//! Next ASID to hand out in the current generation.  ASID 0 is reserved for switching between tables.
+unsigned PageTable::sNextASID = 1;
+
 /*!
- * \brief Construct a page table by copying another table's contents
- * \param copy Page table to copy
+ * \brief Construct a new page table, with nothing mapped in the user portion
  */
-PageTable::PageTable(PageTable *copy)
+PageTable::PageTable()
 {
-	// Allocate contiguous pages to hold page table contents
-	mPages = Page::allocContig(4, 4);
-	mTablePAddr = mPages->paddr();
-
-	unsigned *base = (unsigned*)PADDR_TO_VADDR(mTablePAddr);
-	unsigned *copyBase = (unsigned*)PADDR_TO_VADDR(copy->mTablePAddr);
+#ifdef ARCH_ARMV7
+	// The user portion fits in a single page, and starts out empty
+	mPages = Page::allocZeroed();
+#else
+	// Take a prebuilt table if one is available, and otherwise build one now
+	if(sNumSpareTables > 0) {
+		mPages = sSpareTables.removeHead();
+		sNumSpareTables--;
+	} else {
+		mPages = Page::allocContig(4, 4);
+		buildTable(mPages);
+	}
+#endif
 
-	// Copy contents into new page table
-	memcpy(base, copyBase, PAGE_TABLE_SIZE * sizeof(unsigned));
+	mTablePAddr = mPages->paddr();
+	mASID = 0;
+	mSlotDomains = false;
+	sTables.addTail(this);
+	clearTranslationCache();
 }
 
 /*!
  * \brief Wrap a page table structure around an existing set of pages
+ *
+ * The first table constructed this way becomes the kernel page table.
  * \param pages Pointer to first page of page table
  */
 PageTable::PageTable(Page *pages)
 {
 	mPages = pages;
 	mTablePAddr = mPages->paddr();
+	mASID = 0;
+	mSlotDomains = false;
+	sTables.addTail(this);
+	clearTranslationCache();
+
+	if(!sKernel) {
+		sKernel = this;
+
+#ifdef ARCH_ARMV7
+		// Translate the kernel portion of the address space through this
+		// table from now on, regardless of which table is active
+		SetKernelMMUBase(mTablePAddr);
+#endif
+	}
 }
 
 PageTable::~PageTable()
 {
-	for(int i=0; i<4; i++) {
+	sTables.remove(this);
+
+	// Never leave the MMU pointing at a freed table
+	if(sActive == this) {
+		sKernel->activate();
+	}
+
+	// Release the second-level tables of the user portion.  Those of the
+	// kernel portion are shared by every table, so they stay.
+	unsigned *table = (unsigned*)PADDR_TO_VADDR(mTablePAddr);
+	for(int idx=0; idx<(USER_END >> PAGE_TABLE_SECTION_SHIFT); idx++) {
+		if((table[idx] & PTE_TYPE_MASK) == PTE_TYPE_COARSE) {
+			unsigned *L2Table = (unsigned*)PADDR_TO_VADDR(table[idx] & PTE_COARSE_BASE_MASK);
+			memset(L2Table, 0, PAGE_L2_TABLE_SIZE * sizeof(unsigned));
+			CleanDCacheRange(L2Table, PAGE_L2_TABLE_SIZE * sizeof(unsigned));
+			freeL2Table(L2Table);
+		}
+	}
+
+	for(int i=0; i<USER_TABLE_PAGES; i++) {
 		Page *page = Page::fromNumber(mPages->number() + i);
 		page->free();
 	}
+}
 
-	for(Page *page = mL2Tables.head(); page != 0; page = mL2Tables.next(page)) {
-		page->free();
+/*!
+ * \brief Build one spare table ahead of time
+ *
+ * Called from the scheduler's idle loop, so that new page tables do not
+ * have to be filled in while a process is being spawned.  On ARMv7, new
+ * tables start out empty, so there is never anything to do.
+ * \return True if a table was built, false if there was nothing to do
+ */
+bool PageTable::refillSpare()
+{
+#ifdef ARCH_ARMV7
+	return false;
+#endif
+
+	if(sNumSpareTables >= SPARE_TABLES_SIZE) {
+		return false;
 	}
+
+	Page *pages = Page::allocContig(4, 4);
+	if(!pages) {
+		return false;
+	}
+
+	buildTable(pages);
+	sSpareTables.addTail(pages);
+	sNumSpareTables++;
+
+	return true;
 }
 
-// Allocate a second-level page table
-void PageTable::allocL2Table(void *vaddr)
+// Fill in a fresh top-level table.  Only the kernel portion has any entries,
+// and those are kept in sync with the kernel table from then on (see setEntry).
+void PageTable::buildTable(Page *pages)
 {
-	unsigned *table = (unsigned*)PADDR_TO_VADDR(mTablePAddr);
-	int idx = (unsigned int)vaddr >> PAGE_TABLE_SECTION_SHIFT;
+	unsigned *base = (unsigned*)pages->vaddr();
+	unsigned *kernelBase = (unsigned*)PADDR_TO_VADDR(sKernel->mTablePAddr);
+	int kernelIdx = KERNEL_START >> PAGE_TABLE_SECTION_SHIFT;
 
-	// Search through the list of L2 tables and attempt to find an unused one
-	for(Page *L2Page = mL2Tables.head(); L2Page != 0; L2Page = mL2Tables.next(L2Page)) {
-		unsigned *L2Table = (unsigned*)L2Page->vaddr();
-		// Each 4kb page contains 4 1kb second-level tables
-		for(int i=0; i<4; i++) {
-			int l2idx = i*PAGE_L2_TABLE_SIZE;
-			unsigned l2pte = L2Table[l2idx];
-
-			// If the page table is marked as disabled, all other bits are unused, so this
-			// code uses the top bit as a marker that the table is available for use
-			if((l2pte & PTE_L2_TYPE_MASK) != PTE_L2_TYPE_DISABLED || (l2pte & 0x80000000) == 0) {
-				continue;
-			}
+	memset(base, 0, kernelIdx * sizeof(unsigned));
+	memcpy(base + kernelIdx, kernelBase + kernelIdx, (PAGE_TABLE_SIZE - kernelIdx) * sizeof(unsigned));
 
-			// Found a page--zero it out
-			for(int j=0; j<PAGE_L2_TABLE_SIZE; j++) {
-				L2Table[l2idx + j] = 0;
-			}
+	// Table walks do not look in the data cache
+	CleanDCacheRange(base, PAGE_TABLE_SIZE * sizeof(unsigned));
+}
+
+// Find a top-level entry.  Entries above the user portion are read from
+// the kernel table: on ARMv5 every table holds a copy of them, and on ARMv7
+// they exist only there.
+unsigned *PageTable::entry(int idx)
+{
+	PageTable *pageTable = (idx < (USER_END >> PAGE_TABLE_SECTION_SHIFT)) ? this : sKernel;
+	return (unsigned*)PADDR_TO_VADDR(pageTable->mTablePAddr) + idx;
+}
+
+// Set a top-level entry.  On ARMv5, kernel entries are written to every
+// table, along with the spare ones, so that all tables share the same view
+// of the kernel.  Table walks do not look in the data cache, so each write
+// is cleaned out to memory.
+void PageTable::setEntry(int idx, unsigned pte)
+{
+#ifdef ARCH_ARMV7
+	unsigned *table = entry(idx);
+	*table = pte;
+	CleanDCacheRange(table, sizeof(unsigned));
+#else
+	if(idx < (USER_END >> PAGE_TABLE_SECTION_SHIFT)) {
+		unsigned *table = (unsigned*)PADDR_TO_VADDR(mTablePAddr);
+		table[idx] = pte;
+		CleanDCacheRange(&table[idx], sizeof(unsigned));
+		return;
+	}
+
+	for(PageTable *pageTable = sTables.head(); pageTable != 0; pageTable = sTables.next(pageTable)) {
+		unsigned *table = (unsigned*)PADDR_TO_VADDR(pageTable->mTablePAddr);
+		table[idx] = pte;
+		CleanDCacheRange(&table[idx], sizeof(unsigned));
+	}
+
+	for(Page *pages = sSpareTables.head(); pages != 0; pages = sSpareTables.next(pages)) {
+		unsigned *table = (unsigned*)pages->vaddr();
+		table[idx] = pte;
+		CleanDCacheRange(&table[idx], sizeof(unsigned));
+	}
+#endif
+}
+
+// Domain bits for the top-level entry covering an address.  In a table
+// shared by FCSE slots, each slot's portion lies in the domain numbered after
+// its process ID.  Everything else lies in domain 0.
+unsigned PageTable::domain(void *vaddr)
+{
+	if(mSlotDomains && (unsigned)vaddr < USER_END) {
+		return (((unsigned)vaddr >> FCSE_PID_SHIFT) << PTE_DOMAIN_SHIFT) & PTE_DOMAIN_MASK;
+	}
+
+	return 0;
+}
+
+/*!
+ * \brief Load this page table into the MMU
+ */
+void PageTable::activate()
+{
+#ifdef ARCH_ARMV7
+	if(!currentASID()) {
+		allocASID();
+	}
+#endif
+
+	SetMMUBase(mTablePAddr, mASID & ASID_MASK);
+	sActive = this;
+}
 
-			// Link the new table into the main page table
-			table[idx] = VADDR_TO_PADDR(L2Table + l2idx) | PTE_SECTION_AP_READ_WRITE | PTE_TYPE_COARSE;
+#ifdef ARCH_ARMV7
+// Give this table an ASID from the current generation.  Once every ASID has
+// been handed out, a new generation begins, and the whole TLB is flushed so
+// that the ASIDs can be reused.  Tables holding an ASID from an older
+// generation pick up a new one the next time they are activated.
+void PageTable::allocASID()
+{
+	if(sNextASID > ASID_MASK) {
+		sASIDGeneration += ASID_MASK + 1;
+		sNextASID = 1;
+		FlushTLB();
+	}
+
+	mASID = sASIDGeneration | sNextASID;
+	sNextASID++;
+}
+#endif
+
+// Determine whether the TLB can be holding entries for an address in this
+// table.  Kernel entries are shared by all tables, so they may always be
+// present.  On ARMv5, the TLB is flushed whenever a new table is loaded, so
+// only the active table can have user entries cached.  On ARMv7, user
+// entries are tagged with the ASID, and survive until its generation ends.
+bool PageTable::inTLB(void *vaddr)
+{
+	if(this == sActive || (unsigned)vaddr >= KERNEL_START) {
+		return true;
+	}
+
+#ifdef ARCH_ARMV7
+	return currentASID();
+#else
+	return false;
+#endif
+}
+
+// Empty out the translation cache
+void PageTable::clearTranslationCache()
+{
+	for(int i=0; i<TRANSLATION_CACHE_SIZE; i++) {
+		mTranslationCache[i].vaddr = TRANSLATION_CACHE_EMPTY;
+	}
+}
+
+// Write back and discard any cached data for a page whose mapping is about to
+// change.  The caches are indexed by virtual address, so this must happen
+// while the old mapping is still in place.
+// On ARMv7, the caches are physically tagged, so there is nothing to do.
+void PageTable::writeBackPage(void *vaddr)
+{
+#ifndef ARCH_ARMV7
+	if(this == sActive || (unsigned)vaddr >= KERNEL_START) {
+		CleanInvalidateDCacheRange((void*)PAGE_ADDR_ROUND_DOWN(vaddr), PAGE_SIZE);
+		InvalidateICache();
+	}
+#endif
+}
+
+// As above, for a whole section.  Cleaning a megabyte line by line costs more
+// than emptying the entire cache.
+void PageTable::writeBackSection(void *vaddr)
+{
+#ifndef ARCH_ARMV7
+	if(this == sActive || (unsigned)vaddr >= KERNEL_START) {
+		FlushCaches();
+	}
+#endif
+}
+
+// Discard any TLB entry for an address whose page table entry has changed
+void PageTable::invalidateTLB(void *vaddr)
+{
+	if(inTLB(vaddr)) {
+		InvalidateTLBEntry((void*)(PAGE_ADDR_ROUND_DOWN(vaddr) | (mASID & ASID_MASK)));
+	}
+
+	struct CachedTranslation *cached = &mTranslationCache[((unsigned)vaddr >> PAGE_SHIFT) % TRANSLATION_CACHE_SIZE];
+	if(cached->vaddr == PAGE_ADDR_ROUND_DOWN(vaddr)) {
+		cached->vaddr = TRANSLATION_CACHE_EMPTY;
+	}
+}
+
+// Discard all TLB entries for a section whose top-level entry has changed.
+// The hardware TLB holds a section as a single entry, but the translation
+// cache holds it page by page.
+void PageTable::invalidateSection(void *vaddr)
+{
+	if(inTLB(vaddr)) {
+		InvalidateTLBEntry((void*)(((unsigned)vaddr & PAGE_TABLE_SECTION_MASK) | (mASID & ASID_MASK)));
+	}
+
+	for(int i=0; i<TRANSLATION_CACHE_SIZE; i++) {
+		if((mTranslationCache[i].vaddr & PAGE_TABLE_SECTION_MASK) == ((unsigned)vaddr & PAGE_TABLE_SECTION_MASK)) {
+			mTranslationCache[i].vaddr = TRANSLATION_CACHE_EMPTY;
+		}
+	}
+}
+
+// Allocate a zeroed second-level page table.  The caller links it into the
+// top-level table once it has been filled in.
+unsigned *PageTable::allocL2Table()
+{
+	FreeL2Table *L2Table = sFreeL2Tables.removeHead();
+	if(L2Table) {
+		// Free tables are kept zeroed, apart from the list header
+		memset(L2Table, 0, sizeof(FreeL2Table));
+		CleanDCacheRange(L2Table, sizeof(FreeL2Table));
+	} else {
+		// No free tables--allocate a new zeroed page.  Each 4kb page contains
+		// 4 1kb second-level tables, so put the other 3 on the free list.
+		Page *L2Page = Page::allocZeroed();
+		unsigned *base = (unsigned*)L2Page->vaddr();
+		for(int i=1; i<4; i++) {
+			FreeL2Table *freeTable = (FreeL2Table*)(base + i*PAGE_L2_TABLE_SIZE);
+			freeTable->marker = L2_TABLE_FREE;
+			sFreeL2Tables.addTail(freeTable);
+		}
+
+		L2Table = (FreeL2Table*)base;
+	}
+
+	return (unsigned*)L2Table;
+}
+
+// Return an all-zero second-level table to the free list, and free the page
+// that holds it once all 4 of the tables in the page are free
+void PageTable::freeL2Table(unsigned *L2Table)
+{
+	FreeL2Table *freeTable = (FreeL2Table*)L2Table;
+	freeTable->marker = L2_TABLE_FREE;
+	sFreeL2Tables.addHead(freeTable);
+
+	unsigned *base = (unsigned*)PAGE_ADDR_ROUND_DOWN(L2Table);
+	for(int i=0; i<4; i++) {
+		if(((FreeL2Table*)(base + i*PAGE_L2_TABLE_SIZE))->marker != L2_TABLE_FREE) {
 			return;
 		}
 	}
 
-	// No free tables found--allocate a new page and add it to the list
-	Page *L2Page = Page::alloc();
-	unsigned *L2Table = (unsigned*)L2Page->vaddr();
-	mL2Tables.addTail(L2Page);
+	for(int i=0; i<4; i++) {
+		sFreeL2Tables.remove((FreeL2Table*)(base + i*PAGE_L2_TABLE_SIZE));
+	}
+	Page::fromVAddr(base)->free();
+}
+
+// Build a second-level entry.  Small and large entries keep their permission,
+// cacheability and global bits in the same places.
+unsigned PageTable::l2Entry(void *vaddr, PAddr paddr, unsigned type, Permission permission, Cacheability cacheability)
+{
+	unsigned l2pte = paddr | type;
+
+	switch(permission) {
+		case PermissionNone: l2pte |= PTE_L2_AP_ALL_NONE; break;
+		case PermissionRO: l2pte |= PTE_L2_AP_ALL_READ_ONLY; break;
+		case PermissionRW: l2pte |= PTE_L2_AP_ALL_READ_WRITE; break;
+		case PermissionRWPriv: l2pte |= PTE_L2_AP_ALL_READ_WRITE_PRIV; break;
+	}
+
+	if(cacheability == CacheabilityWriteBack) {
+		l2pte |= PTE_L2_CACHEABLE | PTE_L2_BUFFERABLE;
+	}
+	if((unsigned)vaddr < KERNEL_START) {
+		l2pte |= PTE_L2_NOT_GLOBAL;
+	}
+
+	return l2pte;
+}
+
+// Find the second-level table covering an address, creating one if the
+// section has none.  An existing section mapping is split up into pages,
+// so that the rest of the section stays mapped.
+unsigned *PageTable::l2Table(void *vaddr)
+{
+	int idx = (unsigned int)vaddr >> PAGE_TABLE_SECTION_SHIFT;
+	unsigned pte = *entry(idx);
+
+	switch(pte & PTE_TYPE_MASK) {
+		case PTE_TYPE_COARSE:
+			return (unsigned*)PADDR_TO_VADDR(pte & PTE_COARSE_BASE_MASK);
+
+		case PTE_TYPE_SECTION:
+			return splitSection(vaddr);
+
+		default:
+		{
+			unsigned *L2Table = allocL2Table();
+			setEntry(idx, VADDR_TO_PADDR(L2Table) | domain(vaddr) | PTE_TYPE_COARSE);
+			return L2Table;
+		}
+	}
+}
+
+// Replace a section entry with a second-level table which maps the same
+// memory page by page.  The translation does not change, so the caches can
+// be left alone, but the TLB may still hold the section as a single entry.
+unsigned *PageTable::splitSection(void *vaddr)
+{
+	int idx = (unsigned int)vaddr >> PAGE_TABLE_SECTION_SHIFT;
+	unsigned pte = *entry(idx);
+
+	Permission permission;
+	switch(pte & PTE_SECTION_AP_MASK) {
+		case PTE_SECTION_AP_READ_ONLY: permission = PermissionRO; break;
+		case PTE_SECTION_AP_READ_WRITE: permission = PermissionRW; break;
+		case PTE_SECTION_AP_READ_WRITE_PRIV: permission = PermissionRWPriv; break;
+		default: permission = PermissionNone; break;
+	}
+	Cacheability cacheability = (pte & PTE_SECTION_CACHEABLE) ? CacheabilityWriteBack : CacheabilityUncached;
 
-	// Zero out everything, and mark the other 3 pages as available
-	memset(L2Table, 0, PAGE_L2_TABLE_SIZE * sizeof(unsigned));
-	for(int i=1; i<4; i++) {
-		L2Table[i*PAGE_L2_TABLE_SIZE] = 0x80000000;
+	unsigned base = (unsigned)vaddr & PAGE_TABLE_SECTION_MASK;
+	unsigned *L2Table = allocL2Table();
+	for(int i=0; i<PAGE_L2_TABLE_SIZE; i++) {
+		L2Table[i] = l2Entry((void*)(base + i * PAGE_SIZE), (pte & PTE_SECTION_BASE_MASK) + i * PAGE_SIZE, PTE_L2_TYPE_SMALL, permission, cacheability);
 	}
+	CleanDCacheRange(L2Table, PAGE_L2_TABLE_SIZE * sizeof(unsigned));
+
+	setEntry(idx, VADDR_TO_PADDR(L2Table) | domain(vaddr) | PTE_TYPE_COARSE);
+	invalidateSection(vaddr);
+
+	return L2Table;
+}
 
-	// Link the new table into the main page table
-	table[idx] = VADDR_TO_PADDR(L2Table) | PTE_TYPE_COARSE;
+// Replace the large page covering a second-level entry with the equivalent
+// small pages.  As with sections, the translation does not change, and the
+// caller's TLB invalidation of any one page drops the whole large entry.
+void PageTable::splitLargePage(unsigned *L2Table, int l2idx)
+{
+	int first = l2idx & ~(PTE_L2_LARGE_PAGES - 1);
+	unsigned l2pte = L2Table[first];
+
+	for(int i=0; i<PTE_L2_LARGE_PAGES; i++) {
+		L2Table[first + i] = ((l2pte & PTE_L2_LARGE_BASE_MASK) + i * PAGE_SIZE) | (l2pte & PTE_L2_ATTR_MASK) | PTE_L2_TYPE_SMALL;
+	}
+	CleanDCacheRange(&L2Table[first], PTE_L2_LARGE_PAGES * sizeof(unsigned));
 }
 
 /*!
  * \brief Map a page of physical memory into the page table
+ *
+ * If the page lies within a section or large page mapping, that mapping is
+ * split up first, so the rest of it is left in place.
  * \param vaddr Virtual address to map to
  * \param paddr Physical address to map
  * \param permission Permission flags
+ * \param cacheability Cache policy for the page
  */
-void PageTable::mapPage(void *vaddr, PAddr paddr, Permission permission)
+void PageTable::mapPage(void *vaddr, PAddr paddr, Permission permission, Cacheability cacheability)
 {
-	unsigned *table = (unsigned*)PADDR_TO_VADDR(mTablePAddr);
-	int idx = (unsigned int)vaddr >> PAGE_TABLE_SECTION_SHIFT;
-	unsigned pte = table[idx];
+	unsigned *L2Table = l2Table(vaddr);
+	int l2idx = ((unsigned)vaddr & (~PAGE_TABLE_SECTION_MASK)) >> PAGE_SHIFT;
+	if((L2Table[l2idx] & PTE_L2_TYPE_MASK) == PTE_L2_TYPE_LARGE) {
+		splitLargePage(L2Table, l2idx);
+	}
+
+	// Set the appropriate entry of the second-level page table
+	unsigned l2pte = l2Entry(vaddr, paddr & PTE_L2_BASE_MASK, PTE_L2_TYPE_SMALL, permission, cacheability);
 
-	// If this section does not already have a second-level table,
-	// then allocate one
-	if((pte & PTE_TYPE_MASK) == PTE_TYPE_SECTION ||
-	   (pte & PTE_TYPE_MASK) == PTE_TYPE_DISABLED) {
-	   allocL2Table(vaddr);
+	// Rewriting an entry with the same contents needs no TLB maintenance
+	if(L2Table[l2idx] == l2pte) {
+		return;
 	}
 
-	pte = table[idx];
+	// Entries which were previously disabled are never cached in the TLB
+	bool valid = ((L2Table[l2idx] & PTE_L2_TYPE_MASK) != PTE_L2_TYPE_DISABLED);
+	if(valid) {
+		writeBackPage(vaddr);
+	}
 
-	// Set up permission bits
-	unsigned int perm;
-	switch(permission) {
-		case PermissionNone: perm = PTE_L2_AP_ALL_NONE; break;
-		case PermissionRO: perm = PTE_L2_AP_ALL_READ_ONLY; break;
-		case PermissionRW: perm = PTE_L2_AP_ALL_READ_WRITE; break;
-		case PermissionRWPriv: perm = PTE_L2_AP_ALL_READ_WRITE_PRIV; break;
+	L2Table[l2idx] = l2pte;
+	CleanDCacheRange(&L2Table[l2idx], sizeof(unsigned));
+
+	if(valid) {
+		invalidateTLB(vaddr);
+	}
+}
+
+/*!
+ * \brief Map a 64KB large page of physical memory into the page table
+ *
+ * A large page occupies 16 consecutive second-level entries, each holding
+ * the same value, but is cached in the TLB as a single entry.
+ * \param vaddr Virtual address to map to, aligned to LargePageSize
+ * \param paddr Physical address to map, aligned to LargePageSize
+ * \param permission Permission flags
+ * \param cacheability Cache policy for the page
+ */
+void PageTable::mapLargePage(void *vaddr, PAddr paddr, Permission permission, Cacheability cacheability)
+{
+	unsigned *L2Table = l2Table(vaddr);
+	int first = ((unsigned)vaddr & (~PAGE_TABLE_SECTION_MASK)) >> PAGE_SHIFT;
+	unsigned l2pte = l2Entry(vaddr, paddr & PTE_L2_LARGE_BASE_MASK, PTE_L2_TYPE_LARGE, permission, cacheability);
+
+	bool same = true;
+	bool valid = false;
+	for(int i=0; i<PTE_L2_LARGE_PAGES; i++) {
+		if(L2Table[first + i] != l2pte) {
+			same = false;
+		}
+		if((L2Table[first + i] & PTE_L2_TYPE_MASK) != PTE_L2_TYPE_DISABLED) {
+			valid = true;
+			writeBackPage((char*)vaddr + i * PAGE_SIZE);
+		}
+	}
+
+	if(same) {
+		return;
 	}
 
-	if((pte & PTE_TYPE_MASK) == PTE_TYPE_COARSE) {
-		// Set the appropriate entry of the second-level page table
-		unsigned *L2Table = (unsigned*)PADDR_TO_VADDR(pte & PTE_COARSE_BASE_MASK);
-		int l2idx = ((unsigned)vaddr & (~PAGE_TABLE_SECTION_MASK)) >> PAGE_SHIFT;
-		L2Table[l2idx] = (paddr & PTE_COARSE_BASE_MASK) | perm | PTE_L2_TYPE_SMALL;
+	for(int i=0; i<PTE_L2_LARGE_PAGES; i++) {
+		L2Table[first + i] = l2pte;
+	}
+	CleanDCacheRange(&L2Table[first], PTE_L2_LARGE_PAGES * sizeof(unsigned));
+
+	if(valid) {
+		for(int i=0; i<PTE_L2_LARGE_PAGES; i++) {
+			invalidateTLB((char*)vaddr + i * PAGE_SIZE);
+		}
 	}
 }
 
@@ -135,45 +568,237 @@ void PageTable::mapPage(void *vaddr, PAddr paddr, Permission permission)
  * \param vaddr Virtual address to map
  * \param paddr Physical address to map
  * \param permission Permission flags
+ * \param cacheability Cache policy for the section
  */
-void PageTable::mapSection(void *vaddr, PAddr paddr, Permission permission)
+void PageTable::mapSection(void *vaddr, PAddr paddr, Permission permission, Cacheability cacheability)
 {
 	unsigned int perm;
 
 	// Set up permission bits
 	switch(permission) {
-		case PermissionNone: perm = PTE_L2_AP_ALL_NONE; break;
-		case PermissionRO: perm = PTE_L2_AP_ALL_READ_ONLY; break;
-		case PermissionRW: perm = PTE_L2_AP_ALL_READ_WRITE; break;
-		case PermissionRWPriv: perm = PTE_L2_AP_ALL_READ_WRITE_PRIV; break;
+		case PermissionNone: perm = 0; break;
+		case PermissionRO: perm = PTE_SECTION_AP_READ_ONLY; break;
+		case PermissionRW: perm = PTE_SECTION_AP_READ_WRITE; break;
+		case PermissionRWPriv: perm = PTE_SECTION_AP_READ_WRITE_PRIV; break;
 	}
 
 	// Set the appropriate entry of the top-level page table.  Since this is
 	// a section mapping, there is no second-level table
-	unsigned *table = (unsigned*)PADDR_TO_VADDR(mTablePAddr);
 	unsigned int idx = (unsigned int)vaddr >> PAGE_TABLE_SECTION_SHIFT;
-	table[idx] = (paddr & PTE_SECTION_BASE_MASK) | perm | PTE_TYPE_SECTION;
+	unsigned pte = *entry(idx);
+	unsigned newPte = (paddr & PTE_SECTION_BASE_MASK) | domain(vaddr) | perm | PTE_TYPE_SECTION;
+	if(cacheability == CacheabilityWriteBack) {
+		newPte |= PTE_SECTION_CACHEABLE | PTE_SECTION_BUFFERABLE;
+	}
+	if((unsigned)vaddr < KERNEL_START) {
+		newPte |= PTE_SECTION_NOT_GLOBAL;
+	}
+
+	// Rewriting an entry with the same contents needs no maintenance
+	if(newPte == pte) {
+		return;
+	}
+
+	if((pte & PTE_TYPE_MASK) != PTE_TYPE_DISABLED) {
+		writeBackSection(vaddr);
+	}
+	setEntry(idx, newPte);
+
+	switch(pte & PTE_TYPE_MASK) {
+		case PTE_TYPE_SECTION:
+			invalidateSection(vaddr);
+			break;
+
+		case PTE_TYPE_COARSE:
+		{
+			// Any of the small pages in the old second-level table may be
+			// cached, so the whole TLB must go
+			if(inTLB(vaddr)) {
+				FlushTLB();
+			}
+			invalidateSection(vaddr);
+
+			// The old second-level table is no longer referenced
+			unsigned *L2Table = (unsigned*)PADDR_TO_VADDR(pte & PTE_COARSE_BASE_MASK);
+			memset(L2Table, 0, PAGE_L2_TABLE_SIZE * sizeof(unsigned));
+			CleanDCacheRange(L2Table, PAGE_L2_TABLE_SIZE * sizeof(unsigned));
+			freeL2Table(L2Table);
+			break;
+		}
+	}
+}
+
+/*!
+ * \brief Map a physically contiguous range, using the largest mappings
+ *        which the alignment of the range allows
+ *
+ * Each 1MB or 64KB piece of the range which is aligned in both the virtual
+ * and physical address spaces is mapped as a section or a large page, and
+ * takes only a single TLB entry.  The remainder is mapped page by page.
+ * \param vaddr Virtual address to map to
+ * \param paddr Physical address to map
+ * \param size Size of range
+ * \param permission Permission flags
+ * \param cacheability Cache policy for the range
+ */
+void PageTable::mapRange(void *vaddr, PAddr paddr, unsigned int size, Permission permission, Cacheability cacheability)
+{
+	unsigned v = (unsigned)vaddr;
+	unsigned end = v + size;
+
+	while(v < end) {
+		if(((v | paddr) & (SectionSize - 1)) == 0 && end - v >= SectionSize) {
+			mapSection((void*)v, paddr, permission, cacheability);
+			v += SectionSize;
+			paddr += SectionSize;
+		} else if(((v | paddr) & (LargePageSize - 1)) == 0 && end - v >= LargePageSize) {
+			mapLargePage((void*)v, paddr, permission, cacheability);
+			v += LargePageSize;
+			paddr += LargePageSize;
+		} else {
+			mapPage((void*)v, paddr, permission, cacheability);
+			v += PAGE_SIZE;
+			paddr += PAGE_SIZE;
+		}
+	}
+}
+
+/*!
+ * \brief Remove a range of pages from the page table
+ *
+ * Section and large page entries which only partly overlap the range are
+ * split up first, so that the rest of them stays mapped.  Second-level
+ * tables which are left empty are released.
+ * \param vaddr Starting virtual address
+ * \param size Size of range
+ */
+void PageTable::unmap(void *vaddr, unsigned int size)
+{
+	unsigned start = (unsigned)vaddr;
+	unsigned v = start;
+	unsigned end = v + size;
+
+	while(v < end) {
+		int idx = v >> PAGE_TABLE_SECTION_SHIFT;
+		unsigned sectionStart = v & PAGE_TABLE_SECTION_MASK;
+		unsigned sectionEnd = sectionStart + PAGE_TABLE_SECTION_SIZE;
+		unsigned pte = *entry(idx);
+
+		if((pte & PTE_TYPE_MASK) == PTE_TYPE_SECTION) {
+			if(v == sectionStart && sectionEnd <= end) {
+				writeBackSection((void*)v);
+				setEntry(idx, 0);
+				invalidateSection((void*)v);
+			} else {
+				splitSection((void*)v);
+				pte = *entry(idx);
+			}
+		}
+
+		if((pte & PTE_TYPE_MASK) == PTE_TYPE_COARSE) {
+			unsigned *L2Table = (unsigned*)PADDR_TO_VADDR(pte & PTE_COARSE_BASE_MASK);
+
+			// Clear each page in the range which lies within this section
+			for(; v < end && v < sectionEnd; v += PAGE_SIZE) {
+				int l2idx = (v & (~PAGE_TABLE_SECTION_MASK)) >> PAGE_SHIFT;
+				if((L2Table[l2idx] & PTE_L2_TYPE_MASK) == PTE_L2_TYPE_LARGE) {
+					unsigned largeStart = v & ~(LargePageSize - 1);
+					if(largeStart < start || largeStart + LargePageSize > end) {
+						splitLargePage(L2Table, l2idx);
+					}
+				}
+
+				if((L2Table[l2idx] & PTE_L2_TYPE_MASK) != PTE_L2_TYPE_DISABLED) {
+					writeBackPage((void*)v);
+					L2Table[l2idx] = 0;
+					CleanDCacheRange(&L2Table[l2idx], sizeof(unsigned));
+					invalidateTLB((void*)v);
+				}
+			}
+
+			bool empty = true;
+			for(int i=0; i<PAGE_L2_TABLE_SIZE; i++) {
+				if((L2Table[i] & PTE_L2_TYPE_MASK) != PTE_L2_TYPE_DISABLED) {
+					empty = false;
+					break;
+				}
+			}
+
+			if(empty) {
+				// Nothing is left in the table, so release it
+				setEntry(idx, 0);
+				freeL2Table(L2Table);
+			}
+		}
+
+		v = sectionEnd;
+	}
 }
 
 /*!
  * \brief Translate a virtual address into the corresponding physical address
  *        mapped to by this page table
+ *
+ * Translations of user addresses are remembered in a small cache, so that
+ * copy loops which visit the same pages repeatedly need not walk the table
+ * each time.  The cache is kept coherent alongside the TLB.
  * \param addr Virtual address
- * \return Physical address
+ * \return Physical address, or PADDR_INVALID if the address is not mapped
  */
 PAddr PageTable::translateVAddr(void *addr)
 {
-	unsigned *table = (unsigned*)PADDR_TO_VADDR(mTablePAddr);
+	unsigned vpage = PAGE_ADDR_ROUND_DOWN(addr);
+	unsigned offset = (unsigned)addr & ~PAGE_MASK;
+	struct CachedTranslation *cached = &mTranslationCache[(vpage >> PAGE_SHIFT) % TRANSLATION_CACHE_SIZE];
+	if(cached->vaddr == vpage) {
+		return cached->paddr | offset;
+	}
+
+	PAddr paddr = walk(addr);
+
+	// Kernel entries can be changed through any table, so only user
+	// translations are cached
+	if(paddr != PADDR_INVALID && vpage < KERNEL_START) {
+		cached->vaddr = vpage;
+		cached->paddr = paddr & PAGE_MASK;
+	}
+
+	return paddr;
+}
+
+// Translate an address by walking the page table
+PAddr PageTable::walk(void *addr)
+{
 	int idx = (unsigned)addr >> PAGE_TABLE_SECTION_SHIFT;
-	unsigned pte = table[idx];
+	unsigned pte = *entry(idx);
 
 	if((pte & PTE_TYPE_MASK) == PTE_TYPE_SECTION) {
+		// Sections with no access permissions are used to lock out unmapped
+		// parts of the address space
+		if((pte & PTE_SECTION_AP_MASK) == 0) {
+			return PADDR_INVALID;
+		}
+
 		// Section mapping--dereference the top-level page table entry
 		return (pte & PTE_SECTION_BASE_MASK) | ((unsigned)addr & (~PTE_SECTION_BASE_MASK));
 	}
 
+	if((pte & PTE_TYPE_MASK) != PTE_TYPE_COARSE) {
+		return PADDR_INVALID;
+	}
+
 	// Coarse page table entry--indirect through second-level table to compute address
 	unsigned *L2Table = (unsigned*)PADDR_TO_VADDR(pte & PTE_COARSE_BASE_MASK);
 	int l2idx = ((unsigned)addr & (~PAGE_TABLE_SECTION_MASK)) >> PAGE_SHIFT;
-	return (L2Table[l2idx] & PTE_L2_BASE_MASK) | ((unsigned)addr & (~PTE_L2_BASE_MASK));
+	unsigned l2pte = L2Table[l2idx];
+
+	switch(l2pte & PTE_L2_TYPE_MASK) {
+		case PTE_L2_TYPE_DISABLED:
+			return PADDR_INVALID;
+
+		case PTE_L2_TYPE_LARGE:
+			return (l2pte & PTE_L2_LARGE_BASE_MASK) | ((unsigned)addr & (~PTE_L2_LARGE_BASE_MASK));
+	}
+
+	return (l2pte & PTE_L2_BASE_MASK) | ((unsigned)addr & (~PTE_L2_BASE_MASK));
 }
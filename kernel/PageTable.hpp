@@ -10,7 +10,7 @@
 /*!
  * \brief Represents a page table.
  */
-class PageTable {
+class PageTable : public ListEntry {
 public:
 	enum Permission {
 		PermissionNone,
@@ -19,11 +19,17 @@ public:
 		PermissionRWPriv
 	};
 
-	PageTable(PageTable *copy);
+	enum Cacheability {
+		CacheabilityUncached,
+		CacheabilityWriteBack
+	};
+
+	PageTable();
 	PageTable(Page *pages);
 	~PageTable();
 
 	static void init();
+	static bool refillSpare();
 
 	/*!
 	 * \brief Returns physical address of page table
@@ -31,8 +37,26 @@ public:
 	 */
 	PAddr tablePAddr() { return mTablePAddr; }
 
-	void mapPage(void *vaddr, PAddr paddr, Permission permission);
-	void mapSection(void *vaddr, PAddr paddr, Permission permission);
+	void activate();
+
+	/*!
+	 * \brief Determine whether this page table is loaded into the MMU
+	 * \return True if active
+	 */
+	bool active() { return this == sActive; }
+
+	/*!
+	 * \brief Place each FCSE slot of the user portion in a domain of its own,
+	 *        numbered after the slot's process ID.  Must be called before
+	 *        anything is mapped.
+	 */
+	void setSlotDomains() { mSlotDomains = true; }
+
+	void mapPage(void *vaddr, PAddr paddr, Permission permission, Cacheability cacheability = CacheabilityWriteBack);
+	void mapLargePage(void *vaddr, PAddr paddr, Permission permission, Cacheability cacheability = CacheabilityWriteBack);
+	void mapSection(void *vaddr, PAddr paddr, Permission permission, Cacheability cacheability = CacheabilityWriteBack);
+	void mapRange(void *vaddr, PAddr paddr, unsigned int size, Permission permission, Cacheability cacheability = CacheabilityWriteBack);
+	void unmap(void *vaddr, unsigned int size);
 
 	PAddr translateVAddr(void *vaddr);
 
@@ -41,15 +65,72 @@ public:
 	void operator delete(void *p) { return sSlab.free((PageTable*)p); }
 
 	static const int SectionSize = (1024 * 1024);
+	static const int LargePageSize = (64 * 1024);
 
 private:
+	/*!
+	 * \brief Header overlaid on the first entries of a free second-level table
+	 */
+	struct FreeL2Table : public ListEntry {
+		unsigned marker; //!< Free table marker
+	};
+
+	/*!
+	 * \brief A remembered translation of one page
+	 */
+	struct CachedTranslation {
+		unsigned vaddr; //!< Virtual address of page
+		PAddr paddr; //!< Physical address of page
+	};
+
+	static const int TRANSLATION_CACHE_SIZE = 16;
+
+	//! Mask of the address space ID within an ASID value.  The bits above it hold the generation.
+	static const unsigned ASID_MASK = 0xff;
+
 	Page *mPages;
 	PAddr mTablePAddr;
-	List<Page> mL2Tables;
+	unsigned mASID; //!< Address space ID, combined with the generation in which it was allocated (ARMv7 only)
+	bool mSlotDomains; //!< True if each FCSE slot lies in its own domain
+	struct CachedTranslation mTranslationCache[TRANSLATION_CACHE_SIZE]; //!< Cache of recent translations
 
 	static Slab<PageTable> sSlab;
+	static PageTable *sActive; //!< Page table currently loaded into the MMU
+	static PageTable *sKernel;
+	static List<PageTable> sTables;
+	static List<Page> sSpareTables;
+	static int sNumSpareTables;
+	static List<FreeL2Table> sFreeL2Tables;
+	static unsigned sASIDGeneration;
+	static unsigned sNextASID;
+
+	static void buildTable(Page *pages);
+	unsigned *entry(int idx);
+	void setEntry(int idx, unsigned pte);
+	unsigned domain(void *vaddr);
+	static unsigned *allocL2Table();
+	static void freeL2Table(unsigned *L2Table);
+	unsigned *l2Table(void *vaddr);
+	unsigned *splitSection(void *vaddr);
+	static void splitLargePage(unsigned *L2Table, int l2idx);
+	static unsigned l2Entry(void *vaddr, PAddr paddr, unsigned type, Permission permission, Cacheability cacheability);
+	void writeBackPage(void *vaddr);
+	void writeBackSection(void *vaddr);
+	bool inTLB(void *vaddr);
+	void invalidateTLB(void *vaddr);
+	void invalidateSection(void *vaddr);
+	void clearTranslationCache();
+	PAddr walk(void *addr);
+
+#ifdef ARCH_ARMV7
+	void allocASID();
 
-	void allocL2Table(void *vaddr);
+	/*!
+	 * \brief Determine whether this table holds an ASID from the current generation
+	 * \return True if the ASID is current
+	 */
+	bool currentASID() { return (mASID & ~ASID_MASK) == sASIDGeneration; }
+#endif
 };
 
 #endif
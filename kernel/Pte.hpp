@@ -13,12 +13,24 @@
 #define PTE_TYPE_SECTION 2
 
 #define PTE_SECTION_AP_SHIFT 10
+#define PTE_SECTION_AP_MASK (0x3 << PTE_SECTION_AP_SHIFT)
 #define PTE_SECTION_AP_READ_WRITE (0x3 << PTE_SECTION_AP_SHIFT)
 #define PTE_SECTION_AP_READ_ONLY (0x2 << PTE_SECTION_AP_SHIFT)
 #define PTE_SECTION_AP_READ_WRITE_PRIV (0x1 << PTE_SECTION_AP_SHIFT)
+#define PTE_SECTION_BUFFERABLE (1 << 2)
+#define PTE_SECTION_CACHEABLE (1 << 3)
 #define PTE_SECTION_BASE_MASK 0xfff00000
 #define PTE_SECTION_BASE_SHIFT 20
 
+// Top-level entries assign their memory to one of 16 domains, whose access
+// is switched on and off as a whole through the domain access register
+#define PTE_DOMAIN_SHIFT 5
+#define PTE_DOMAIN_MASK (0xf << PTE_DOMAIN_SHIFT)
+#define PTE_NUM_DOMAINS 16
+
+#define DOMAIN_ACCESS_CLIENT(domain) (0x1 << ((domain) * 2))
+#define DOMAIN_ACCESS_ALL_CLIENT 0x55555555
+
 #define PTE_COARSE_BASE_MASK 0xfffffc00
 #define PTE_COARSE_BASE_SHIFT 10
 
@@ -29,22 +41,45 @@
 #define PTE_L2_TYPE_LARGE 1
 #define PTE_L2_TYPE_SMALL 2
 
+#define PTE_L2_BUFFERABLE (1 << 2)
+#define PTE_L2_CACHEABLE (1 << 3)
+
 #define PTE_L2_AP0_SHIFT 4
 #define PTE_L2_AP1_SHIFT 6
 #define PTE_L2_AP2_SHIFT 8
 #define PTE_L2_AP3_SHIFT 10
 
-
 #define PTE_L2_AP_READ_WRITE 0x3
 #define PTE_L2_AP_READ_ONLY 0x2
 #define PTE_L2_AP_READ_WRITE_PRIV 0x1
 #define PTE_L2_AP_NONE 0x0
+
+#ifdef ARCH_ARMV7
+// ARMv7 small pages have a single set of access permissions, in the place
+// of the first ARMv5 subpage.  Non-global entries are tagged in the TLB with
+// the current address space ID.
+#define PTE_L2_AP_ALL_READ_WRITE (PTE_L2_AP_READ_WRITE << PTE_L2_AP0_SHIFT)
+#define PTE_L2_AP_ALL_READ_ONLY (PTE_L2_AP_READ_ONLY << PTE_L2_AP0_SHIFT)
+#define PTE_L2_AP_ALL_READ_WRITE_PRIV (PTE_L2_AP_READ_WRITE_PRIV << PTE_L2_AP0_SHIFT)
+#define PTE_L2_AP_ALL_NONE 0x0
+#define PTE_L2_NOT_GLOBAL (1 << 11)
+#define PTE_SECTION_NOT_GLOBAL (1 << 17)
+#else
 #define PTE_L2_AP_ALL_READ_WRITE 0xff0
-#define PTE_L2_AP_ALL_READ_ONLY 0xCC0
+#define PTE_L2_AP_ALL_READ_ONLY 0xAA0
 #define PTE_L2_AP_ALL_READ_WRITE_PRIV 0x550
 #define PTE_L2_AP_ALL_NONE 0x0
+#define PTE_L2_NOT_GLOBAL 0
+#define PTE_SECTION_NOT_GLOBAL 0
+#endif
 
 #define PTE_L2_BASE_MASK 0xfffff000
 #define PTE_L2_BASE_SHIFT 12
 
+// A large page is repeated across 16 consecutive entries.  Its permission,
+// cacheability and global bits sit in the same places as a small page's.
+#define PTE_L2_LARGE_BASE_MASK 0xffff0000
+#define PTE_L2_LARGE_PAGES 16
+#define PTE_L2_ATTR_MASK 0xffc
+
 #endif
@@ -8,6 +8,8 @@
 #include "Process.hpp"
 #include "AddressSpace.hpp"
 #include "Interrupt.hpp"
+#include "Page.hpp"
+#include "Ksm.hpp"
 
 #include <string.h>
 
@@ -43,7 +45,7 @@ void Sched::switchTo(Task *task)
 		// MMU switches are necessary
 		if(task->process() != Kernel::process()) {
 			task->setEffectiveAddressSpace(task->process()->addressSpace());
-			SetMMUBase(task->process()->addressSpace()->pageTable()->tablePAddr());
+			task->process()->addressSpace()->activate();
 		} else {
 			task->setEffectiveAddressSpace(sCurrent->effectiveAddressSpace());
 		}
@@ -74,7 +76,12 @@ void Sched::runNext()
 			switchTo(next);
 			break;
 		} else {
-			WaitForInterrupt();
+			// Nothing to run.  Use the idle time to refill the zeroed page
+			// pool and the spare page tables, then to merge identical pages,
+			// and only sleep once there is nothing left to do.
+			if(!Page::refillZeroed() && !PageTable::refillSpare() && !Ksm::scan()) {
+				WaitForInterrupt();
+			}
 			Interrupt::dispatch();
 		}
 	}
@@ -21,6 +21,11 @@
 
 #include <algorithm>
 
+//! Marker in the low bit of an object's data, identifying a shared memory
+//! object.  The data of other objects is a slab-allocated process pointer,
+//! for which the bit is always clear.
+#define SHARED_MEM_OBJECT 0x1
+
 Server::Server()
 {
 	// Create and register the process manager object
@@ -28,20 +33,114 @@ Server::Server()
 	mKernelObject = Object_Create(mChannel, 0);
 }
 
-int Server::startUserProcess(const char *cmdline, int stdinObject, int stdoutObject, int stderrObject, int nameserverObject)
+int Server::startUserProcess(const char *cmdline, int stdinObject, int stdoutObject, int stderrObject, int nameserverObject, unsigned flags, unsigned int stackSize)
 {
-	// Create a new process
-	Process *process = new Process();
+	// Create a new process.  If the caller asked for a fast context switch
+	// slot and none is free, fall back to an address space of its own.
+	AddressSpace *addressSpace = 0;
+	if(flags & KERNEL_SPAWN_FCSE) {
+		addressSpace = AddressSpace::createFCSE();
+	}
+	Process *process = new Process(addressSpace);
+	if(flags & KERNEL_SPAWN_MERGEABLE) {
+		process->addressSpace()->setMergeable();
+	}
 
 	// Construct the process object, to which userspace will send messages
 	// in order to access process services
 	int processObject = Object_Create(mChannel, (unsigned)process);
 
-	UserProcess::start(process, cmdline, stdinObject, stdoutObject, stderrObject, mKernelObject, processObject, nameserverObject);
+	UserProcess::start(process, cmdline, stdinObject, stdoutObject, stderrObject, mKernelObject, processObject, nameserverObject, stackSize);
+
+	return processObject;
+}
+
+int Server::forkUserProcess(Process *parent, Task *parentTask)
+{
+	// Create a new process around a copy-on-write clone of the parent's address space
+	AddressSpace *addressSpace = parent->addressSpace()->clone();
+	if(!addressSpace) {
+		return OBJECT_INVALID;
+	}
+
+	Process *process = new Process(addressSpace);
+
+	int processObject = Object_Create(mChannel, (unsigned)process);
+
+	UserProcess::fork(process, parent, parentTask, processObject);
 
 	return processObject;
 }
 
+/*!
+ * \brief Create a shared memory object, which can be passed between processes
+ *        and mapped by each of them
+ * \param size Size of shared memory
+ * \return New object id
+ */
+int Server::createSharedMem(unsigned int size)
+{
+	return createMemObject(new MemAreaShared(size));
+}
+
+/*!
+ * \brief Wrap a memory area in an object which processes can map through
+ *        this server
+ *
+ * This is also used by file servers within the kernel, to hand out mappings
+ * of file contents.
+ * \param area Memory area
+ * \return New object id, in the kernel process
+ */
+int Server::createMemObject(MemArea *area)
+{
+	// The object holds a reference on the area for as long as it is open
+	area->ref();
+
+	return Object_Create(mChannel, (unsigned)area | SHARED_MEM_OBJECT);
+}
+
+/*!
+ * \brief Map a shared memory object into a process
+ * \param process Process to map into
+ * \param obj Shared memory object id, in the kernel process
+ * \param vaddr Virtual address to map at, or 0 to pick a free range
+ * \param offset Offset within the shared memory to map
+ * \param size Size of mapping
+ * \return Address mapped at, or 0 if the object is not shared memory, or the
+ *         range is invalid or overlaps an existing mapping
+ */
+void *Server::mapSharedMem(Process *process, int obj, void *vaddr, unsigned int offset, unsigned int size)
+{
+	// Only trust the marker on objects which this server created
+	Object *object = Sched::current()->process()->object(obj);
+	if(!object || object->channel() != Sched::current()->process()->channel(mChannel) || !(object->data() & SHARED_MEM_OBJECT)) {
+		return 0;
+	}
+
+	MemArea *area = reinterpret_cast<MemArea*>(object->data() & ~SHARED_MEM_OBJECT);
+	if(offset > (unsigned)area->size() || size > area->size() - offset) {
+		return 0;
+	}
+
+	if(!vaddr) {
+		vaddr = process->addressSpace()->findFree(size);
+	}
+
+	if(!vaddr) {
+		return 0;
+	}
+
+	// Shared memory areas clone to themselves, so every process sees the same
+	// pages.  Other areas, such as mapped files, have copy-on-write state which
+	// only works for a single mapper, so each process gets its own copy.
+	if(!process->addressSpace()->map(area->clone(), vaddr, offset, size)) {
+		return 0;
+	}
+
+	return vaddr;
+}
+
 // Main task for process manager
 void Server::run()
 {
@@ -65,7 +164,9 @@ void Server::run()
 						message.kernel.spawn.stdinObject,
 						message.kernel.spawn.stdoutObject,
 						message.kernel.spawn.stderrObject,
-						message.kernel.spawn.nameserverObject
+						message.kernel.spawn.nameserverObject,
+						message.kernel.spawn.flags,
+						message.kernel.spawn.stackSize
 					);
 					Object_Release(message.kernel.spawn.stdinObject);
 					Object_Release(message.kernel.spawn.stdoutObject);
@@ -108,6 +209,20 @@ void Server::run()
 					break;
 				}
 			}
+		} else if(targetData & SHARED_MEM_OBJECT) {
+			// Shared memory objects are only passed around and mapped, never
+			// sent to.  Once the last handle is closed, the area is released
+			// along with the server's reference on it, although any existing
+			// mappings keep it alive.
+			MemArea *area = reinterpret_cast<MemArea*>(targetData & ~SHARED_MEM_OBJECT);
+			if(msg == 0) {
+				if(message.process.event.type == SysEventObjectClosed) {
+					area->unref();
+				}
+				continue;
+			}
+
+			Message_Reply(msg, -1, 0, 0);
 		} else {
 			// Grab the process to which this message was directed
 			Process *process = reinterpret_cast<Process*>(targetData);
@@ -129,26 +244,43 @@ void Server::run()
 					// Map physical memory request.  Create a physical memory area and map it into
 					// the sending process.
 					MemArea *area = new MemAreaPhys(message.process.mapPhys.size, message.process.mapPhys.paddr);
-					process->addressSpace()->map(area, (void*)message.process.mapPhys.vaddr, 0, area->size());
+					int ret = process->addressSpace()->map(area, (void*)message.process.mapPhys.vaddr, 0, area->size()) ? 0 : -1;
 
-					Message_Reply(msg, 0, 0, 0);
+					Message_Reply(msg, ret, 0, 0);
 					break;
 				}
 
 				case ProcessMap:
 				{
-					MemArea *area = new MemAreaPages(message.process.map.size);
-					process->addressSpace()->map(area, (void*)message.process.map.vaddr, 0, area->size());
+					// Without an address, pick one from the top of the address space
+					void *vaddr = (void*)message.process.map.vaddr;
+					if(!vaddr) {
+						vaddr = process->addressSpace()->findFree(message.process.map.size);
+					}
 
-					Message_Reply(msg, 0, 0, 0);
+					int ret = -1;
+					if(vaddr) {
+						MemArea *area = new MemAreaPages(message.process.map.size, message.process.map.flags & PROCESS_MAP_LARGE_PAGES);
+						if(process->addressSpace()->map(area, vaddr, 0, area->size())) {
+							ret = 0;
+						}
+					}
+
+					Message_Reply(msg, ret, &vaddr, sizeof(vaddr));
 					break;
 				}
 
 				case ProcessExpandMap:
 				{
-					MemArea *area = process->addressSpace()->lookupMap((void*)message.process.map.vaddr);
-					area->expand(message.process.map.size);
-					process->addressSpace()->expandMap(area, message.process.map.size);
+					int ret = process->addressSpace()->expandMap((void*)message.process.map.vaddr, message.process.map.size) ? 0 : -1;
+
+					Message_Reply(msg, ret, 0, 0);
+					break;
+				}
+
+				case ProcessUnmap:
+				{
+					process->addressSpace()->unmap((void*)message.process.map.vaddr, message.process.map.size);
 
 					Message_Reply(msg, 0, 0, 0);
 					break;
@@ -166,6 +298,46 @@ void Server::run()
 					process->addWaiter(msg);
 					break;
 				}
+
+				case ProcessFork:
+				{
+					// Clone the sending process.  The parent receives the new process object,
+					// while the child resumes from the same send with an untouched reply buffer.
+					Task *sender = Sched::current()->process()->message(msg)->sender();
+					int obj = forkUserProcess(process, sender);
+					if(obj == OBJECT_INVALID) {
+						Message_Reply(msg, -1, 0, 0);
+						break;
+					}
+
+					Message_Replyh(msg, 0, &obj, sizeof(obj), 0, 1);
+					Object_Release(obj);
+					break;
+				}
+
+				case ProcessCreateSharedMem:
+				{
+					int obj = createSharedMem(message.process.createSharedMem.size);
+
+					Message_Replyh(msg, 0, &obj, sizeof(obj), 0, 1);
+					Object_Release(obj);
+					break;
+				}
+
+				case ProcessMapSharedMem:
+				{
+					void *vaddr = mapSharedMem(
+						process,
+						message.process.mapSharedMem.object,
+						(void*)message.process.mapSharedMem.vaddr,
+						message.process.mapSharedMem.offset,
+						message.process.mapSharedMem.size
+					);
+					Object_Release(message.process.mapSharedMem.object);
+
+					Message_Reply(msg, vaddr ? 0 : -1, &vaddr, sizeof(vaddr));
+					break;
+				}
 			}
 		}
 	}
@@ -2,6 +2,9 @@
 #define SERVER_H
 
 class Object;
+class MemArea;
+class Process;
+class Task;
 
 /*!
  * \brief Process services for userspace
@@ -10,7 +13,11 @@ class Server {
 public:
 	Server();
 
-	int startUserProcess(const char *cmdline, int stdinObject, int stdoutObject, int stderrObject, int nameserverObject);
+	int startUserProcess(const char *cmdline, int stdinObject, int stdoutObject, int stderrObject, int nameserverObject, unsigned flags, unsigned int stackSize);
+	int forkUserProcess(Process *parent, Task *parentTask);
+	int createSharedMem(unsigned int size);
+	int createMemObject(MemArea *area);
+	void *mapSharedMem(Process *process, int obj, void *vaddr, unsigned int offset, unsigned int size);
 	void run();
 
 private:
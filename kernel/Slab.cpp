@@ -57,17 +57,13 @@ void *SlabBase::allocate()
 		}
 	}
 
-	// No item found.  Allocate a new page and add it to the list
-	Page *page = Page::alloc();
+	// No item found.  Allocate a new page and add it to the list.  The page
+	// comes back zeroed, so the bitfield starts out empty.
+	Page *page = Page::allocZeroed();
 	mPages.addTail(page);
 
-	// Initialize the bitfield in the new page
-	struct SlabHead *head = (struct SlabHead*)page->vaddr();
-	for(int i=0; i<mBitfieldLen; i++) {
-		head->bitfield[i] = 0;
-	}
-
 	// Return the first item in the new page
+	struct SlabHead *head = (struct SlabHead*)page->vaddr();
 	head->bitfield[0] = 1 << mDataStart;
 	return (char*)page->vaddr() + (mDataStart << mOrder);
 }
@@ -23,6 +23,20 @@ void *memset(void *dest, int c, unsigned int n)
 	return dest;
 }
 
+int memcmp(const void *ptr1, const void *ptr2, size_t n)
+{
+	const unsigned char *p1 = (const unsigned char*)ptr1;
+	const unsigned char *p2 = (const unsigned char*)ptr2;
+
+	for(int i=0; i<n; i++) {
+		if(p1[i] != p2[i]) {
+			return (p1[i] < p2[i]) ? -1 : 1;
+		}
+	}
+
+	return 0;
+}
+
 char *strcpy(char *dest, const char *src)
 {
 	int i;
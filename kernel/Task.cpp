@@ -46,6 +46,23 @@ void *Task::stackAllocate(int size)
 	return (void*)mRegs[R_SP];
 }
 
+/*!
+ * \brief Retrieve the userspace registers of a task blocked in a syscall
+ *
+ * The syscall entry code saves r1-r14 and the return address at the top
+ * of the kernel stack, which is reset to its top on every entry into
+ * userspace.  r0 is not preserved, and is returned as 0.
+ * \param regs Array to hold r0-r15
+ */
+void Task::getUserRegs(unsigned *regs)
+{
+	unsigned *frame = (unsigned*)stackTop() - 15;
+
+	regs[0] = 0;
+	memcpy(regs + 1, frame + 1, 14 * sizeof(unsigned));
+	regs[R_PC] = frame[0];
+}
+
 /*!
  * \brief Start executing the task
  * \param start Task function
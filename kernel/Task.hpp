@@ -70,7 +70,14 @@ public:
 	 */
 	void setEffectiveAddressSpace(AddressSpace *addressSpace) { mEffectiveAddressSpace = addressSpace; }
 
+	/*!
+	 * \brief Top of the task's kernel stack
+	 * \return Stack top
+	 */
+	void *stackTop() { return (char*)mStack->vaddr() + PAGE_SIZE; }
+
 	void *stackAllocate(int size);
+	void getUserRegs(unsigned *regs);
 	void start(void (*start)(void *), void *param);
 
 	virtual void onLastRef();
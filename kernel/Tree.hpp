@@ -0,0 +1,270 @@
+#ifndef TREE_H
+#define TREE_H
+
+/*!
+ * \brief Intrusive balanced tree entry type.
+ *
+ * Inherit the item type from this class, and use the class Tree.
+ */
+struct TreeEntry {
+	TreeEntry *parent; //!< Parent node
+	TreeEntry *left; //!< Left child
+	TreeEntry *right; //!< Right child
+	int height; //!< Height of the subtree rooted at this node
+
+	TreeEntry() {
+		parent = 0;
+		left = 0;
+		right = 0;
+		height = 1;
+	}
+};
+
+/*!
+ * \brief Intrusive AVL tree.  Uses TreeEntry to store tree pointers, and
+ *        orders items by the key member given as a template parameter
+ */
+template<typename T, typename K, K T::*key>
+class Tree {
+public:
+	//! Constructor
+	Tree() {
+		mRoot = 0;
+	}
+
+	//! Initialize
+	void init() {
+		mRoot = 0;
+	}
+
+	/*!
+	 * \brief Item with the smallest key
+	 * \return Head
+	 */
+	T *head() {
+		TreeEntry *entry = mRoot;
+		if(!entry) {
+			return 0;
+		}
+
+		while(entry->left) {
+			entry = entry->left;
+		}
+
+		return static_cast<T*>(entry);
+	}
+
+	/*!
+	 * \brief Get next item in key order
+	 * \param entry Current item
+	 * \return Next item
+	 */
+	T *next(TreeEntry *entry) {
+		if(entry->right) {
+			entry = entry->right;
+			while(entry->left) {
+				entry = entry->left;
+			}
+			return static_cast<T*>(entry);
+		}
+
+		while(entry->parent && entry->parent->right == entry) {
+			entry = entry->parent;
+		}
+
+		return entry->parent ? static_cast<T*>(entry->parent) : 0;
+	}
+
+	/*!
+	 * \brief Find the item with a given key
+	 * \param k Key
+	 * \return Item, or 0
+	 */
+	T *find(K k) {
+		TreeEntry *entry = mRoot;
+		while(entry) {
+			if(k == keyOf(entry)) {
+				return static_cast<T*>(entry);
+			}
+
+			entry = (k < keyOf(entry)) ? entry->left : entry->right;
+		}
+
+		return 0;
+	}
+
+	/*!
+	 * \brief Find the item with the largest key less than or equal to a given key
+	 * \param k Key
+	 * \return Item, or 0
+	 */
+	T *findFloor(K k) {
+		TreeEntry *entry = mRoot;
+		TreeEntry *best = 0;
+		while(entry) {
+			if(keyOf(entry) <= k) {
+				best = entry;
+				entry = entry->right;
+			} else {
+				entry = entry->left;
+			}
+		}
+
+		return best ? static_cast<T*>(best) : 0;
+	}
+
+	/*!
+	 * \brief Add item to tree
+	 * \param entry Item to add
+	 */
+	void add(TreeEntry *entry) {
+		entry->left = 0;
+		entry->right = 0;
+		entry->height = 1;
+
+		// Walk down to the leaf position for the new item
+		TreeEntry *parent = 0;
+		TreeEntry **link = &mRoot;
+		while(*link) {
+			parent = *link;
+			link = (keyOf(entry) < keyOf(parent)) ? &parent->left : &parent->right;
+		}
+
+		*link = entry;
+		entry->parent = parent;
+
+		rebalance(parent);
+	}
+
+	/*!
+	 * \brief Remove item
+	 * \param entry Item to remove
+	 */
+	void remove(TreeEntry *entry) {
+		TreeEntry *rebalanceFrom;
+
+		if(entry->left && entry->right) {
+			// Two children--splice the in-order successor into this item's place
+			TreeEntry *successor = entry->right;
+			while(successor->left) {
+				successor = successor->left;
+			}
+
+			if(successor->parent == entry) {
+				rebalanceFrom = successor;
+			} else {
+				rebalanceFrom = successor->parent;
+				replaceChild(successor->parent, successor, successor->right);
+				successor->right = entry->right;
+				successor->right->parent = successor;
+			}
+
+			replaceChild(entry->parent, entry, successor);
+			successor->left = entry->left;
+			successor->left->parent = successor;
+		} else {
+			// At most one child--move it up into this item's place
+			TreeEntry *child = entry->left ? entry->left : entry->right;
+			rebalanceFrom = entry->parent;
+			replaceChild(entry->parent, entry, child);
+		}
+
+		entry->parent = 0;
+		entry->left = 0;
+		entry->right = 0;
+		entry->height = 1;
+
+		rebalance(rebalanceFrom);
+	}
+
+	/*!
+	 * \brief Determines if tree is empty
+	 * \return True if empty, false otherwise
+	 */
+	bool empty() { return mRoot == 0; }
+
+private:
+	static K keyOf(TreeEntry *entry) { return static_cast<T*>(entry)->*key; }
+	static int height(TreeEntry *entry) { return entry ? entry->height : 0; }
+
+	static void updateHeight(TreeEntry *entry) {
+		int left = height(entry->left);
+		int right = height(entry->right);
+		entry->height = 1 + ((left > right) ? left : right);
+	}
+
+	// Point the parent's link to an item at a new child instead
+	void replaceChild(TreeEntry *parent, TreeEntry *old, TreeEntry *child) {
+		if(!parent) {
+			mRoot = child;
+		} else if(parent->left == old) {
+			parent->left = child;
+		} else {
+			parent->right = child;
+		}
+
+		if(child) {
+			child->parent = parent;
+		}
+	}
+
+	TreeEntry *rotateLeft(TreeEntry *entry) {
+		TreeEntry *pivot = entry->right;
+
+		entry->right = pivot->left;
+		if(pivot->left) {
+			pivot->left->parent = entry;
+		}
+
+		replaceChild(entry->parent, entry, pivot);
+		pivot->left = entry;
+		entry->parent = pivot;
+
+		updateHeight(entry);
+		updateHeight(pivot);
+		return pivot;
+	}
+
+	TreeEntry *rotateRight(TreeEntry *entry) {
+		TreeEntry *pivot = entry->left;
+
+		entry->left = pivot->right;
+		if(pivot->right) {
+			pivot->right->parent = entry;
+		}
+
+		replaceChild(entry->parent, entry, pivot);
+		pivot->right = entry;
+		entry->parent = pivot;
+
+		updateHeight(entry);
+		updateHeight(pivot);
+		return pivot;
+	}
+
+	// Restore the AVL balance condition from an item up to the root
+	void rebalance(TreeEntry *entry) {
+		while(entry) {
+			updateHeight(entry);
+			int balance = height(entry->left) - height(entry->right);
+
+			if(balance > 1) {
+				if(height(entry->left->left) < height(entry->left->right)) {
+					rotateLeft(entry->left);
+				}
+				entry = rotateRight(entry);
+			} else if(balance < -1) {
+				if(height(entry->right->right) < height(entry->right->left)) {
+					rotateRight(entry->right);
+				}
+				entry = rotateLeft(entry);
+			}
+
+			entry = entry->parent;
+		}
+	}
+
+	TreeEntry *mRoot; //!< Root of tree
+};
+
+#endif
@@ -12,8 +12,17 @@
 
 #include <string.h>
 
+#include <algorithm>
+
+//! Stack size limit for processes which do not ask for one
+#define STACK_SIZE_DEFAULT (64 * 1024)
+
+//! Largest stack size limit a process may ask for
+#define STACK_SIZE_MAX (1024 * 1024)
+
 struct StartupInfo {
 	char cmdline[KERNEL_CMDLINE_LEN];
+	unsigned int stackSize;
 };
 
 // Shim function to kickstart newly-spawned processes.
@@ -21,16 +30,19 @@ static void startUser(void *param)
 {
 	struct StartupInfo *startupInfo = (struct StartupInfo*)param;
 	Process *process = Sched::current()->process();
+	char *userEnd = (char*)process->addressSpace()->userEnd();
 
-	// Allocate a userspace stack for the task.
-	int stackSize = PAGE_SIZE;
-	MemArea *stackArea = new MemAreaPages(stackSize);
-	char *stackVAddr = (char*)(KERNEL_START - stackArea->size());
+	// Reserve a userspace stack for the task, at the top of the user address
+	// range.  Its pages are only allocated as the stack grows down into them.
+	// The stack area starts with a guard page which is never backed, so that
+	// running off the end faults instead of corrupting whatever lies beneath.
+	MemArea *stackArea = new MemAreaStack(startupInfo->stackSize);
+	char *stackVAddr = userEnd - stackArea->size();
 	process->addressSpace()->map(stackArea, stackVAddr, 0, stackArea->size());
 
 	// Copy the command line into the top of the userspace stack
-	char *cmdlineVAddr = (char*)(KERNEL_START - KERNEL_CMDLINE_LEN);
-	memcpy(cmdlineVAddr, startupInfo->cmdline, KERNEL_CMDLINE_LEN);
+	char *cmdlineVAddr = userEnd - KERNEL_CMDLINE_LEN;
+	AddressSpace::memcpy(process->addressSpace(), cmdlineVAddr, 0, startupInfo->cmdline, KERNEL_CMDLINE_LEN);
 
 	// Load the executable into the process
 	Elf::Entry entry = Elf::load(process->addressSpace(), startupInfo->cmdline);
@@ -38,13 +50,24 @@ static void startUser(void *param)
 	// Everything is now set up in the new process.  The time has come at last
 	// to enter userspace.  This call never returns--any transfer back to kernel
 	// mode from this task will come in the form of syscalls.
-	EnterUser(entry, cmdlineVAddr, cmdlineVAddr);
+	EnterUser(entry, cmdlineVAddr, cmdlineVAddr, Sched::current()->stackTop());
+
+	// Poof!
+}
+
+// Shim function to resume a forked task in userspace
+static void startForked(void *param)
+{
+	unsigned *regs = (unsigned*)param;
+
+	// Pick up exactly where the parent left off.  This call never returns.
+	ResumeUser(regs, Sched::current()->stackTop());
 
 	// Poof!
 }
 
 // Start the named process in userspace
-void UserProcess::start(Process *process, const char *cmdline, int stdinObject, int stdoutObject, int stderrObject, int kernelObject, int processObject, int nameserverObject)
+void UserProcess::start(Process *process, const char *cmdline, int stdinObject, int stdoutObject, int stderrObject, int kernelObject, int processObject, int nameserverObject, unsigned int stackSize)
 {
 	Log::printf("processManager: start process %s\n", cmdline);
 
@@ -62,7 +85,36 @@ void UserProcess::start(Process *process, const char *cmdline, int stdinObject,
 	struct StartupInfo *startupInfo = (struct StartupInfo *)task->stackAllocate(sizeof(struct StartupInfo));
 	memcpy(startupInfo->cmdline, cmdline, KERNEL_CMDLINE_LEN);
 
+	if(stackSize == 0) {
+		stackSize = STACK_SIZE_DEFAULT;
+	}
+	startupInfo->stackSize = std::min(PAGE_SIZE_ROUND_UP(stackSize), (unsigned)STACK_SIZE_MAX);
+
 	// Start the task--it will load the executable on its own thread, to avoid
 	// blocking this task.
 	task->start(startUser, startupInfo);
 }
+
+// Start a forked copy of a process's task in userspace
+void UserProcess::fork(Process *process, Process *parent, Task *parentTask, int processObject)
+{
+	Log::printf("processManager: fork process\n");
+
+	// Duplicate all of the parent's handles into the child, except for the
+	// process handle, which must refer to the child itself
+	for(int i=0; i<16; i++) {
+		if(i != PROCESS_NO) {
+			process->dupObjectRefTo(i, parent, i);
+		}
+	}
+	process->dupObjectRefTo(PROCESS_NO, Sched::current()->process(), processObject);
+
+	// Create a task within the process, and give it a copy of the parent
+	// task's registers.  The syscall returns 0 in the child.
+	Task *task = process->newTask();
+
+	unsigned *regs = (unsigned*)task->stackAllocate(16 * sizeof(unsigned));
+	parentTask->getUserRegs(regs);
+
+	task->start(startForked, regs);
+}
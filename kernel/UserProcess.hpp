@@ -5,7 +5,8 @@
 
 class UserProcess {
 public:
-	static void start(Process *process, const char *cmdline, int stdinObject, int stdoutObject, int stderrObject, int kernelObject, int processObject, int nameserverObject);
+	static void start(Process *process, const char *cmdline, int stdinObject, int stdoutObject, int stderrObject, int kernelObject, int processObject, int nameserverObject, unsigned int stackSize);
+	static void fork(Process *process, Process *parent, Task *parentTask, int processObject);
 
 };
 
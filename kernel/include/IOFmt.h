@@ -7,7 +7,8 @@ enum IOMsgType {
 	IOMsgTypeWrite,
 	IOMsgTypeRead,
 	IOMsgTypeSeek,
-	IOMsgTypeReadDir
+	IOMsgTypeReadDir,
+	IOMsgTypeMap
 };
 
 struct IOMsgReadWriteHdr {
@@ -18,6 +19,11 @@ struct IOMsgSeek {
 	int pointer;
 };
 
+struct IOMsgMap {
+	int offset;
+	int size;
+};
+
 struct IOMsgReadDirRet {
 	char name[32];
 };
@@ -29,6 +35,7 @@ struct IOMsg {
 			union {
 				struct IOMsgReadWriteHdr rw;
 				struct IOMsgSeek seek;
+				struct IOMsgMap map;
 			};
 		};
 		struct Event event;
@@ -1,9 +1,39 @@
 #ifndef INIT_FS_FMT_H
 #define INIT_FS_FMT_H
 
+// Alignment of every file record, and of the file data within it
+#define INIT_FS_PAGE_SIZE 4096
+
 #define INIT_FS_NAME_LEN 32
+#define INIT_FS_SEGMENTS_MAX 8
+
+// A loadable segment of an executable, laid out ahead of time so that
+// segment data sits at the same offset within a page as its virtual address
+struct InitFsSegment {
+	unsigned vaddr;
+	unsigned offset;
+	unsigned fileSize;
+	unsigned memSize;
+};
+
+// Directory index at the start of the image.  It is followed by numFiles
+// InitFsIndexEntry records, sorted by name, and padded out to a page.
+struct InitFsIndex {
+	int numFiles;
+};
+
+struct InitFsIndexEntry {
+	int offset;
+	char name[INIT_FS_NAME_LEN];
+};
+
 struct InitFsFileHeader {
 	int size;
+	int dataOffset;
+	int next;
+	unsigned entry;
+	int numSegments;
+	struct InitFsSegment segments[INIT_FS_SEGMENTS_MAX];
 	char name[INIT_FS_NAME_LEN];
 };
 
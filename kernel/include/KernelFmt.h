@@ -12,12 +12,19 @@ enum KernelMsgType {
 };
 
 #define KERNEL_CMDLINE_LEN 64
+
+// Spawn flags
+#define KERNEL_SPAWN_FCSE 0x1 //!< Place the process in a fast context switch slot, limiting it to 32MB
+#define KERNEL_SPAWN_MERGEABLE 0x2 //!< Allow identical pages to be merged with those of other mergeable processes
+
 struct KernelMsgSpawnProcess {
 	char cmdline[KERNEL_CMDLINE_LEN];
 	int stdinObject;
 	int stdoutObject;
 	int stderrObject;
 	int nameserverObject;
+	unsigned flags;
+	unsigned stackSize; //!< Limit on the size of the process's stack, or 0 for the default
 };
 
 struct KernelMsgSubInt {
@@ -8,8 +8,12 @@ enum ProcessMsgType {
 	ProcessMapPhys,
 	ProcessMap,
 	ProcessExpandMap,
+	ProcessUnmap,
 	ProcessKill,
-	ProcessWait
+	ProcessWait,
+	ProcessFork,
+	ProcessCreateSharedMem,
+	ProcessMapSharedMem
 };
 
 struct ProcessMsgMapPhys {
@@ -18,9 +22,24 @@ struct ProcessMsgMapPhys {
 	unsigned int size;
 };
 
+// Map flags
+#define PROCESS_MAP_LARGE_PAGES 0x1 //!< Allocate whole 64KB and 1MB blocks as soon as any part of one is touched
+
 struct ProcessMsgMap {
 	unsigned int vaddr;
 	unsigned int size;
+	unsigned int flags;
+};
+
+struct ProcessMsgCreateSharedMem {
+	unsigned int size;
+};
+
+struct ProcessMsgMapSharedMem {
+	int object;
+	unsigned int vaddr;
+	unsigned int offset;
+	unsigned int size;
 };
 
 struct ProcessMsg {
@@ -30,6 +49,8 @@ struct ProcessMsg {
 			union {
 				struct ProcessMsgMapPhys mapPhys;
 				struct ProcessMsgMap map;
+				struct ProcessMsgCreateSharedMem createSharedMem;
+				struct ProcessMsgMapSharedMem mapSharedMem;
 			};
 		};
 		struct Event event;
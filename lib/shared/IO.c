@@ -43,6 +43,22 @@ void File_Seek(int obj, int pointer)
 	Object_Send(obj, &msg, sizeof(msg), NULL, 0);
 }
 
+int File_Map(int obj, int offset, int size)
+{
+	struct IOMsg msg;
+	int mem = OBJECT_INVALID;
+
+	msg.type = IOMsgTypeMap;
+	msg.map.offset = offset;
+	msg.map.size = size;
+
+	if(Object_Send(obj, &msg, sizeof(msg), &mem, sizeof(mem)) != 0) {
+		return OBJECT_INVALID;
+	}
+
+	return mem;
+}
+
 int File_ReadDir(int obj, char *name)
 {
 	struct IOMsg msg;
@@ -8,6 +8,7 @@ extern "C" {
 int File_Write(int obj, void *buffer, int size);
 int File_Read(int obj, void *buffer, int size);
 void File_Seek(int obj, int pointer);
+int File_Map(int obj, int offset, int size);
 
 int File_ReadDir(int obj, char *name);
 
@@ -1,11 +1,13 @@
 #include <System.h>
 #include <Message.h>
 #include <Object.h>
+#include <IO.h>
 
 #include <kernel/include/ProcessFmt.h>
 #include <kernel/include/Objects.h>
 
 #include <stddef.h>
+#include <sys/mman.h>
 
 void MapPhys(void *vaddr, unsigned int paddr, unsigned int size)
 {
@@ -17,3 +19,91 @@ void MapPhys(void *vaddr, unsigned int paddr, unsigned int size)
 	msg.mapPhys.size = size;
 	Object_Send(PROCESS_NO, &msg, sizeof(msg), NULL, 0);
 }
+
+void Unmap(void *vaddr, unsigned int size)
+{
+	struct ProcessMsg msg;
+
+	msg.type = ProcessUnmap;
+	msg.map.vaddr = (unsigned int)vaddr;
+	msg.map.size = size;
+	msg.map.flags = 0;
+	Object_Send(PROCESS_NO, &msg, sizeof(msg), NULL, 0);
+}
+
+int SharedMem_Create(unsigned int size)
+{
+	struct ProcessMsg msg;
+	int obj = OBJECT_INVALID;
+
+	msg.type = ProcessCreateSharedMem;
+	msg.createSharedMem.size = size;
+	if(Object_Send(PROCESS_NO, &msg, sizeof(msg), &obj, sizeof(obj)) != 0) {
+		return OBJECT_INVALID;
+	}
+
+	return obj;
+}
+
+void *SharedMem_Map(int obj, void *vaddr, unsigned int offset, unsigned int size)
+{
+	struct ProcessMsg msg;
+	int objectsOffset;
+
+	msg.type = ProcessMapSharedMem;
+	msg.mapSharedMem.object = obj;
+	msg.mapSharedMem.vaddr = (unsigned int)vaddr;
+	msg.mapSharedMem.offset = offset;
+	msg.mapSharedMem.size = size;
+	objectsOffset = offsetof(struct ProcessMsg, mapSharedMem.object);
+	if(Object_Sendhs(PROCESS_NO, &msg, sizeof(msg), objectsOffset, 1, &vaddr, sizeof(vaddr)) != 0) {
+		return NULL;
+	}
+
+	return vaddr;
+}
+
+void *mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset)
+{
+	unsigned int size = (length + 0xfff) & ~0xfff;
+	struct ProcessMsg msg;
+	int mem;
+
+	// Without MAP_FIXED, the kernel picks a free range below the stack, which
+	// keeps clear of the heap whatever the size of the address space
+	if(!(flags & MAP_FIXED)) {
+		addr = NULL;
+	}
+
+	if(flags & MAP_ANONYMOUS) {
+		msg.type = ProcessMap;
+		msg.map.vaddr = (unsigned int)addr;
+		msg.map.size = size;
+		msg.map.flags = (flags & MAP_HUGETLB) ? PROCESS_MAP_LARGE_PAGES : 0;
+		if(Object_Send(PROCESS_NO, &msg, sizeof(msg), &addr, sizeof(addr)) != 0) {
+			return MAP_FAILED;
+		}
+		return addr;
+	}
+
+	// Ask the file's server for a memory object covering the range, and map
+	// that.  Only the first access to each page goes through the server.
+	mem = File_Map(fd, offset, length);
+	if(mem == OBJECT_INVALID) {
+		return MAP_FAILED;
+	}
+
+	addr = SharedMem_Map(mem, addr, 0, size);
+	Object_Release(mem);
+	if(addr == NULL) {
+		return MAP_FAILED;
+	}
+
+	return addr;
+}
+
+int munmap(void *addr, size_t length)
+{
+	Unmap(addr, length);
+	return 0;
+}
@@ -1,6 +1,7 @@
 #include <Object.h>
 #include <IO.h>
 #include <Name.h>
+#include <System.h>
 
 #include <kernel/include/ProcessFmt.h>
 #include <kernel/include/KernelFmt.h>
@@ -14,24 +15,57 @@ int _open(const char *name, int flags, int mode)
 	return Name_Open(name);
 }
 
-#define HEAP_START (char*)0x10000000
+// The heap starts low enough to fit in a fast context switch slot
+#define HEAP_START (char*)0x01000000
+
+//! Default granularity with which the heap mapping grows and shrinks
+#define HEAP_CHUNK_SIZE (64 * 1024)
+
+//! Current heap growth granularity
+static int heapChunkSize = HEAP_CHUNK_SIZE;
+
+void SetHeapChunkSize(unsigned int size)
+{
+	// Chunks must be whole pages, and at least one page
+	size = (size + 0xfff) & ~0xfff;
+	heapChunkSize = (size > 0) ? size : 0x1000;
+}
 
 void *_sbrk(int inc)
 {
 	static int heapSize = 0;
+	static int heapMapped = 0;
 	struct ProcessMsg msg;
-
-	if(heapSize == 0) {
-		msg.type = ProcessMap;
-	} else {
-		msg.type = ProcessExpandMap;
+	int newSize = heapSize + inc;
+
+	if(newSize > heapMapped) {
+		// Grow the mapping by whole chunks, so that a burst of small
+		// allocations costs a single message to the kernel
+		int mapped = (newSize + heapChunkSize - 1) / heapChunkSize * heapChunkSize;
+
+		if(heapMapped == 0) {
+			msg.type = ProcessMap;
+		} else {
+			msg.type = ProcessExpandMap;
+		}
+		msg.map.vaddr = (unsigned int)HEAP_START;
+		msg.map.size = mapped;
+		msg.map.flags = 0;
+		if(Object_Send(PROCESS_NO, &msg, sizeof(msg), NULL, 0) != 0) {
+			return (void*)-1;
+		}
+		heapMapped = mapped;
+	} else if(heapMapped - newSize >= 2 * heapChunkSize) {
+		// Only give memory back once two chunks are free, and keep one of
+		// them, so that a heap which hovers around a chunk boundary does not
+		// map and unmap the same chunk over and over
+		int mapped = (newSize + heapChunkSize - 1) / heapChunkSize * heapChunkSize + heapChunkSize;
+		Unmap(HEAP_START + mapped, heapMapped - mapped);
+		heapMapped = mapped;
 	}
-	msg.map.vaddr = (unsigned int)HEAP_START;
-	msg.map.size = heapSize + inc;
-	Object_Send(PROCESS_NO, &msg, sizeof(msg), NULL, 0);
 
 	void *ret = HEAP_START + heapSize;
-	heapSize += inc;
+	heapSize = newSize;
 
 	return ret;
 }
@@ -12,10 +12,10 @@
 
 int SpawnProcess(const char *argv[], int stdinObject, int stdoutObject, int stderrObject)
 {
-	return SpawnProcessx(argv, stdinObject, stdoutObject, stderrObject, NAMESERVER_NO);
+	return SpawnProcessx(argv, stdinObject, stdoutObject, stderrObject, NAMESERVER_NO, 0, 0);
 }
 
-int SpawnProcessx(const char *argv[], int stdinObject, int stdoutObject, int stderrObject, int nameserverObject)
+int SpawnProcessx(const char *argv[], int stdinObject, int stdoutObject, int stderrObject, int nameserverObject, unsigned flags, unsigned stackSize)
 {
 	struct KernelMsg msg;
 	int child;
@@ -36,6 +36,8 @@ int SpawnProcessx(const char *argv[], int stdinObject, int stdoutObject, int std
 	msg.spawn.stdoutObject = stdoutObject;
 	msg.spawn.stderrObject = stderrObject;
 	msg.spawn.nameserverObject = nameserverObject;
+	msg.spawn.flags = flags;
+	msg.spawn.stackSize = stackSize;
 
 	int objectsOffset = offsetof(struct KernelMsg, spawn.stdinObject);
 	Object_Sendhs(KERNEL_NO, &msg, sizeof(msg), objectsOffset, 4, &child, sizeof(child));
@@ -47,4 +49,19 @@ void WaitProcess(int process)
 	struct ProcessMsg msg;
 	msg.type = ProcessWait;
 	Object_Send(process, &msg, sizeof(msg), NULL, 0);
+}
+
+int ForkProcess()
+{
+	struct ProcessMsg msg;
+	int child = OBJECT_INVALID;
+
+	// The child resumes from this send with a copy of the parent's memory, taken
+	// before the reply was written, so it sees OBJECT_INVALID here.  If the
+	// fork fails, there is no child, and the parent sees -1.
+	msg.type = ProcessFork;
+	if(Object_Send(PROCESS_NO, &msg, sizeof(msg), &child, sizeof(child)) != 0) {
+		return -1;
+	}
+	return child;
 }
\ No newline at end of file
@@ -6,10 +6,16 @@ extern "C" {
 #endif
 
 void MapPhys(void *vaddr, unsigned int paddr, unsigned int size);
+void Unmap(void *vaddr, unsigned int size);
+void SetHeapChunkSize(unsigned int size);
+
+int SharedMem_Create(unsigned int size);
+void *SharedMem_Map(int obj, void *vaddr, unsigned int offset, unsigned int size);
 
 int SpawnProcess(const char *argv[], int stdinObject, int stoutObject, int stderrObject);
-int SpawnProcessx(const char *argv[], int stdinObject, int stoutObject, int stderrObject, int nameserverObject);
+int SpawnProcessx(const char *argv[], int stdinObject, int stoutObject, int stderrObject, int nameserverObject, unsigned flags, unsigned stackSize);
 void WaitProcess(int process);
+int ForkProcess();
 
 int Interrupt_Subscribe(unsigned irq, int object, unsigned type, unsigned value);
 void Interrupt_Unmask(int irq);
@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <Object.h>
+#include <System.h>
+
+#if defined(BOARD_VEXPRESS_A9)
+// Versatile Express motherboard timer 0, which counts down at 1MHz
+#define TIMER_BASE 0x10011000
+#define TIMER_REGS (TIMER_BASE + 0x000)
+#else
+// Integrator/CP counter/timer 1, which counts down at 1MHz
+#define TIMER_BASE 0x13000000
+#define TIMER_REGS (TIMER_BASE + 0x100)
+#endif
+
+#define TIMER_LOAD (volatile unsigned*)(TIMER_REGS + 0x0)
+#define TIMER_VALUE (volatile unsigned*)(TIMER_REGS + 0x4)
+#define TIMER_CONTROL (volatile unsigned*)(TIMER_REGS + 0x8)
+
+#define TIMER_ENABLE 0x80
+#define TIMER_32BIT 0x02
+
+#define BUFFER_SIZE (64 * 1024)
+
+static char *bufferA;
+static char *bufferB;
+
+// Microseconds elapsed on the free-running timer
+static unsigned now()
+{
+	return 0xffffffff - *TIMER_VALUE;
+}
+
+static void benchMemset()
+{
+	int i;
+	for(i=0; i<256; i++) {
+		memset(bufferA, i, BUFFER_SIZE);
+	}
+}
+
+static void benchMemcpy()
+{
+	int i;
+	for(i=0; i<256; i++) {
+		memcpy(bufferB, bufferA, BUFFER_SIZE);
+	}
+}
+
+static volatile unsigned checksum;
+
+static void benchChecksum()
+{
+	int i, j;
+	unsigned sum = 0;
+	for(i=0; i<1024; i++) {
+		for(j=0; j<4096; j++) {
+			sum = (sum << 1) ^ bufferA[j] ^ (sum >> 31);
+		}
+	}
+	checksum = sum;
+}
+
+static void benchSpawn()
+{
+	const char *argv[] = { "/boot/hello", NULL };
+	int i;
+	for(i=0; i<16; i++) {
+		int child = SpawnProcess(argv, STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO);
+		WaitProcess(child);
+		Object_Release(child);
+	}
+}
+
+static void run(const char *name, void (*func)())
+{
+	unsigned start = now();
+	func();
+	unsigned end = now();
+
+	printf("%-12s %10u us\n", name, end - start);
+}
+
+int main(int argc, char *argv[])
+{
+	MapPhys((void*)TIMER_BASE, TIMER_BASE, 4096);
+	*TIMER_CONTROL = 0;
+	*TIMER_LOAD = 0xffffffff;
+	*TIMER_CONTROL = TIMER_ENABLE | TIMER_32BIT;
+
+	bufferA = malloc(BUFFER_SIZE);
+	bufferB = malloc(BUFFER_SIZE);
+	memset(bufferA, 0, BUFFER_SIZE);
+	memset(bufferB, 0, BUFFER_SIZE);
+
+	run("memset", benchMemset);
+	run("memcpy", benchMemcpy);
+	run("checksum", benchChecksum);
+	run("spawn", benchSpawn);
+
+	return 0;
+}
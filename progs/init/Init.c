@@ -2,21 +2,36 @@
 #include <Object.h>
 #include <Name.h>
 
+#include <kernel/include/KernelFmt.h>
+#include <kernel/include/Objects.h>
+
 #include <stdlib.h>
 #include <fcntl.h>
 
+#if defined(BOARD_VEXPRESS_A9)
+#define UART0_PADDR "0x10009000"
+#define UART0_IRQ "37"
+#else
+#define UART0_PADDR "0x16000000"
+#define UART0_IRQ "1"
+#endif
+
 extern int __NameServer;
 int main(int argc, char *argv[])
 {
 	int console;
 	int child;
-	const char *childArgv[4];
+	const char *childArgv[5];
 
 	childArgv[0] = "/boot/uart-pl011";
 	childArgv[1] = "/dev/uart0";
-	childArgv[2] = "0x16000000";
-	childArgv[3] = NULL;
-	child = SpawnProcess(childArgv, OBJECT_INVALID, OBJECT_INVALID, OBJECT_INVALID);
+	childArgv[2] = UART0_PADDR;
+	childArgv[3] = UART0_IRQ;
+	childArgv[4] = NULL;
+
+	// The drivers are small, and switched to on every character, so place
+	// them in fast context switch slots
+	child = SpawnProcessx(childArgv, OBJECT_INVALID, OBJECT_INVALID, OBJECT_INVALID, NAMESERVER_NO, KERNEL_SPAWN_FCSE | KERNEL_SPAWN_MERGEABLE, 0);
 	Object_Release(child);
 
 	Name_Wait("/dev/uart0");
@@ -25,7 +40,7 @@ int main(int argc, char *argv[])
 	childArgv[1] = "/dev/console";
 	childArgv[2] = "/dev/uart0";
 	childArgv[3] = NULL;
-	child = SpawnProcess(childArgv, OBJECT_INVALID, OBJECT_INVALID, OBJECT_INVALID);
+	child = SpawnProcessx(childArgv, OBJECT_INVALID, OBJECT_INVALID, OBJECT_INVALID, NAMESERVER_NO, KERNEL_SPAWN_FCSE | KERNEL_SPAWN_MERGEABLE, 0);
 	Object_Release(child);
 
 	Name_Wait("/dev/console");
@@ -199,7 +199,7 @@ int main(int argc, char *argv[])
 
 	childArgv[0] = argv[1];
 	childArgv[1] = NULL;
-	child = SpawnProcessx(childArgv, OBJECT_INVALID, OBJECT_INVALID, OBJECT_INVALID, obj);
+	child = SpawnProcessx(childArgv, OBJECT_INVALID, OBJECT_INVALID, OBJECT_INVALID, obj, 0, 0);
 	Object_Release(child);
 
 	while(1) {
@@ -6,6 +6,7 @@
 
 #include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #include <kernel/include/IOFmt.h>
 #include <kernel/include/NameFmt.h>
@@ -15,6 +16,10 @@
 
 volatile unsigned *uartbase;
 
+// Address at which to map the registers.  This lies below the heap, so that
+// the driver fits in a fast context switch slot.
+#define UART_VADDR (volatile unsigned*)0x00f00000
+
 #define UARTDR   (uartbase + 0)
 #define UARTIMSC (uartbase + 14)
 #define UARTMIS  (uartbase + 16)
@@ -74,10 +79,13 @@ int main(int argc, char *argv[])
 
 	Name_Set(argv[1], server);
 
-	sscanf(argv[2], "0x%x", &uartbase);
-	MapPhys((void*)uartbase, (int)uartbase, 4096);
+	unsigned paddr;
+	sscanf(argv[2], "0x%x", &paddr);
+	uartbase = UART_VADDR;
+	MapPhys((void*)uartbase, paddr, 4096);
 	*UARTIMSC = 0x10;
-	Interrupt_Subscribe(1, server, IRQEvent, 0);
+	int irq = atoi(argv[3]);
+	Interrupt_Subscribe(irq, server, IRQEvent, 0);
 
 	while(1) {
 		union {
@@ -109,7 +117,7 @@ int main(int argc, char *argv[])
 						}
 					}
 
-					Interrupt_Unmask(1);
+					Interrupt_Unmask(irq);
 					break;
 				}
 			}
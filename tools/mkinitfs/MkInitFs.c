@@ -2,22 +2,96 @@
 #include <stdlib.h>
 #include <string.h>
 #include <getopt.h>
+#include <elf.h>
 
 #include <kernel/include/InitFsFmt.h>
 
 #define LINE_LEN 100
 
+#define ROUND_UP(x) (((x) + INIT_FS_PAGE_SIZE - 1) & ~(INIT_FS_PAGE_SIZE - 1))
+
+// Pad the output file with zeroes up to the given offset
+static void pad(FILE *output, long offset)
+{
+	while(ftell(output) < offset) {
+		fputc(0, output);
+	}
+}
+
+// Lay out the loadable segments of an ELF executable after its file data,
+// so that the kernel can map them without parsing the ELF file itself.
+// Returns the offset just past the last segment, or 0 if the file is not
+// a suitable executable.  The file offset of each segment's data is
+// stored in sources.
+static int layoutSegments(struct InitFsFileHeader *header, const char *buffer, int offset, int *sources)
+{
+	const Elf32_Ehdr *hdr = (const Elf32_Ehdr*)buffer;
+	const Elf32_Phdr *phdrs;
+	int i;
+
+	if(header->size < sizeof(Elf32_Ehdr) || memcmp(hdr->e_ident, ELFMAG, SELFMAG) != 0 ||
+	   hdr->e_ident[EI_CLASS] != ELFCLASS32 || hdr->e_phoff + hdr->e_phnum * sizeof(Elf32_Phdr) > header->size) {
+		return 0;
+	}
+
+	phdrs = (const Elf32_Phdr*)(buffer + hdr->e_phoff);
+	header->numSegments = 0;
+	for(i=0; i<hdr->e_phnum; i++) {
+		struct InitFsSegment *segment;
+
+		if(phdrs[i].p_type != PT_LOAD) {
+			continue;
+		}
+
+		// Reject segments whose data runs past the end of the file, as well as
+		// files with more segments than the header has room for
+		if(header->numSegments == INIT_FS_SEGMENTS_MAX ||
+		   phdrs[i].p_offset > header->size || phdrs[i].p_filesz > header->size - phdrs[i].p_offset) {
+			header->numSegments = 0;
+			return 0;
+		}
+
+		// Place the segment data at the same offset within a page as its virtual address
+		segment = &header->segments[header->numSegments++];
+		segment->vaddr = phdrs[i].p_vaddr;
+		segment->offset = offset + (phdrs[i].p_vaddr & (INIT_FS_PAGE_SIZE - 1));
+		segment->fileSize = phdrs[i].p_filesz;
+		segment->memSize = phdrs[i].p_memsz;
+		sources[header->numSegments - 1] = phdrs[i].p_offset;
+		offset = ROUND_UP(segment->offset + segment->fileSize);
+	}
+
+	header->entry = hdr->e_entry;
+	return offset;
+}
+
+// An input file, read into memory and laid out ahead of writing
+struct InputFile {
+	struct InitFsFileHeader header;
+	char *buffer;
+	int sources[INIT_FS_SEGMENTS_MAX];
+};
+
+static int compareEntries(const void *a, const void *b)
+{
+	return strcmp(((const struct InitFsIndexEntry*)a)->name, ((const struct InitFsIndexEntry*)b)->name);
+}
+
 int main(int argc, char *argv[])
 {
 	char *outputFilename = NULL;
 	FILE *output = NULL;
 	char c;
-	struct InitFsFileHeader header;
+	struct InputFile *files;
+	struct InitFsIndex index;
+	struct InitFsIndexEntry *entries;
+	int indexSize;
+	int offset;
 	int i;
-	char buffer[256];
+	int split = 0;
 
 	while(1) {
-		c = getopt(argc, argv, "o:");
+		c = getopt(argc, argv, "o:s");
 		if(c == -1) {
 			break;
 		}
@@ -27,21 +101,31 @@ int main(int argc, char *argv[])
 				outputFilename = optarg;
 				break;
 
+			case 's':
+				split = 1;
+				break;
 		}
 	}
 
-	if(outputFilename != NULL) {
-		output = fopen(outputFilename, "wb");
-		if(output == NULL) {
-			fprintf(stderr, "Error: Could not open output file %s\n", optarg);
-			exit(1);
-		}
+	if(outputFilename == NULL) {
+		return 0;
+	}
+
+	output = fopen(outputFilename, "wb");
+	if(output == NULL) {
+		fprintf(stderr, "Error: Could not open output file %s\n", optarg);
+		exit(1);
 	}
 
+	// Read in all of the files and lay each one out
+	files = malloc(sizeof(struct InputFile) * argc);
+	index.numFiles = 0;
 	for(i=optind; i<argc; i++) {
+		struct InputFile *file = &files[index.numFiles];
 		char *int_name;
 		char *ext_name;
 		char *slash;
+		FILE *data_file;
 
 		ext_name = argv[i];
 		slash = strrchr(argv[i], '\\');
@@ -55,33 +139,73 @@ int main(int argc, char *argv[])
 			int_name = argv[i];
 		}
 
-		if(output != NULL) {
-			FILE *data_file;
-			char *buffer;
+		data_file = fopen(ext_name, "rb");
+		if(data_file == NULL) {
+			fprintf(stderr, "Error: Could not open file %s\n", ext_name);
+			continue;
+		}
 
-			data_file = fopen(ext_name, "rb");
-			if(data_file == NULL) {
-				fprintf(stderr, "Error: Could not open file %s\n", ext_name);
-				continue;
+		memset(&file->header, 0, sizeof(file->header));
+		strcpy(file->header.name, int_name);
+		fseek(data_file, 0, SEEK_END);
+		file->header.size = ftell(data_file);
+		fseek(data_file, 0, SEEK_SET);
+
+		file->buffer = malloc(file->header.size);
+		fread(file->buffer, file->header.size, 1, data_file);
+		fclose(data_file);
+
+		// File data starts on the page following the header, and the next
+		// record starts on the page following the data (and segments, if any)
+		file->header.dataOffset = ROUND_UP(sizeof(file->header));
+		file->header.next = ROUND_UP(file->header.dataOffset + file->header.size);
+		if(split) {
+			int end = layoutSegments(&file->header, file->buffer, file->header.next, file->sources);
+			if(end != 0) {
+				file->header.next = end;
 			}
+		}
+
+		index.numFiles++;
+	}
+
+	// Build the directory index, which precedes the file records, and sort it
+	// so that the kernel can binary search it
+	indexSize = ROUND_UP(sizeof(index) + index.numFiles * sizeof(struct InitFsIndexEntry));
+	entries = malloc(sizeof(struct InitFsIndexEntry) * index.numFiles);
+	offset = indexSize;
+	for(i=0; i<index.numFiles; i++) {
+		memset(&entries[i], 0, sizeof(entries[i]));
+		strcpy(entries[i].name, files[i].header.name);
+		entries[i].offset = offset;
+		offset += files[i].header.next;
+	}
+	qsort(entries, index.numFiles, sizeof(struct InitFsIndexEntry), compareEntries);
+
+	fwrite(&index, sizeof(index), 1, output);
+	fwrite(entries, sizeof(struct InitFsIndexEntry), index.numFiles, output);
+	pad(output, indexSize);
 
-			strcpy(header.name, int_name);
-			fseek(data_file, 0, SEEK_END);
-			header.size = ftell(data_file);
-			fseek(data_file, 0, SEEK_SET);
+	// Now write out the file records themselves
+	for(i=0; i<index.numFiles; i++) {
+		struct InputFile *file = &files[i];
+		long start = ftell(output);
+		int s;
 
-			fwrite(&header, sizeof(header), 1, output);
-			buffer = malloc(header.size);
-			fread(buffer, header.size, 1, data_file);
-			fwrite(buffer, header.size, 1, output);
+		fwrite(&file->header, sizeof(file->header), 1, output);
+		pad(output, start + file->header.dataOffset);
+		fwrite(file->buffer, file->header.size, 1, output);
 
-			fclose(data_file);
+		for(s=0; s<file->header.numSegments; s++) {
+			pad(output, start + file->header.segments[s].offset);
+			fwrite(file->buffer + file->sources[s], file->header.segments[s].fileSize, 1, output);
 		}
-	}
+		pad(output, start + file->header.next);
 
-	if(output != NULL) {
-		fclose(output);
+		free(file->buffer);
 	}
 
+	fclose(output);
+
 	return 0;
-}
\ No newline at end of file
+}